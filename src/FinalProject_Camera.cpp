@@ -8,6 +8,7 @@
 #include <deque>
 #include <cmath>
 #include <limits>
+#include <memory>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -20,12 +21,51 @@
 #include "objectDetection2D.hpp"
 #include "lidarData.hpp"
 #include "camFusion.hpp"
+#include "artifactCache.hpp"
+#include "sweepEngine.hpp"
+#include "frameStore.hpp"
+#include "streamingPipeline.hpp"
+#include "featurePipeline.hpp"
+#include "hammingMatcher.hpp"
+#include "guidedMatching.hpp"
+#include "kltTracker.hpp"
+#include "tracing.hpp"
+#include "visualizationSink.hpp"
 
 using namespace std;
 
+// a frame travelling through the pipeline stages of run()
+struct FrameJob
+{
+    size_t imgIndex; // frame index relative to imgStartIndex
+    string imgNumber; // zero-padded file index
+    string imgFullFilename;
+    DataFrame frame;
+    ostringstream log; // output of the concurrent stages, printed by the tracking stage in frame order
+};
+
+// keypoint correspondences of a tracked object, recorded by run() for benchmark_ttc_camera()
+struct TTCCameraInput
+{
+    vector<cv::KeyPoint> kptsPrev, kptsCurr;
+    vector<cv::DMatch> kptMatches;
+    double frameRate;
+};
+
+// how run() executes, for callers which run it several times (e.g. concurrently in a sweep)
+struct RunOptions
+{
+    bool bStreamingPipeline = true; // each stage on its own thread, otherwise all stages of a frame in turn on the calling thread
+    std::ostream *log = &std::cout; // per-frame progress, nullptr for none
+    bool bUseArtifactCache = false; // reuse YOLO detections, keypoints and descriptors stored on disk by previous runs
+    std::string artifactCacheDir = "artifact_cache"; // relative to the working directory
+    size_t yoloBatchSize = 1; // no. of frames per forward pass, values > 1 enable batched offline inference on the recorded sequence
+};
+
 /* MAIN PROGRAM */
 //int main(int argc, const char *argv[])
-int run(std::string detectorType, std::string descriptorType, std::vector<float> *TTCEstimates = nullptr)
+int run(std::string detectorType, std::string descriptorType, std::vector<float> *TTCEstimates = nullptr, VisMode visMode = VisMode::INTERACTIVE,
+        std::vector<TTCCameraInput> *ttcCameraInputs = nullptr, const RunOptions &options = RunOptions())
 {
     /* INIT VARIABLES AND DATA STRUCTURES */
 
@@ -70,151 +110,369 @@ int run(std::string detectorType, std::string descriptorType, std::vector<float>
     P_rect_00.at<double>(1,0) = 0.000000e+00; P_rect_00.at<double>(1,1) = 7.215377e+02; P_rect_00.at<double>(1,2) = 1.728540e+02; P_rect_00.at<double>(1,3) = 0.000000e+00;
     P_rect_00.at<double>(2,0) = 0.000000e+00; P_rect_00.at<double>(2,1) = 0.000000e+00; P_rect_00.at<double>(2,2) = 1.000000e+00; P_rect_00.at<double>(2,3) = 0.000000e+00;    
 
+    // fused projection matrix, computed once for all frames
+    LidarCameraCalibration lidarCalibration(P_rect_00, R_rect_00, RT);
+
     // misc
     double sensorFrameRate = 10.0 / imgStepWidth; // frames per second for Lidar and camera
     int dataBufferSize = 2;       // no. of images which are held in memory (ring buffer) at the same time
     deque<DataFrame> dataBuffer; // list of data frames which are held in memory at the same time
     bool bVis = false;            // visualize results
+    bool bSampledTTCCamera = false; // estimate camera TTC from a bounded sample of keypoint pairs instead of all of them
+    float ttcCameraRankError = defaultTTCCameraRankError; // max. rank error of the sampled median distance ratio
+
+    // keypoint detection, description and matching, configured once for the whole sequence
+    string matcherType = "MAT_BF";        // MAT_BF, MAT_FLANN
+    string selectorType = "SEL_KNN";       // SEL_NN, SEL_KNN
+    FeaturePipeline features(detectorType, descriptorType, matcherType, selectorType);
+    DetectionTiling detectionTiling; // parallel detection on overlapping tiles, keypoint budgets
+    detectionTiling.tilesX = 1;      // 1 x 1 tile: whole image on one thread
+    detectionTiling.tilesY = 1;
+    detectionTiling.maxKeypointsPerTile = 0; // 0: no limit
+    detectionTiling.maxKeypoints = 0;
+    features.setTiling(detectionTiling);
+    bool bKltTracking = false;      // track keypoints by optical flow instead of describing and matching them
+    KltTracker kltTracker(5, 300);  // detect again every 5 frames or if less than 300 keypoints could be tracked
+    bool bGuidedMatching = false;   // match only within a window around the position predicted from the previous motion (always kNN ratio test)
+    float guidedSearchRadius = 40;  // search window radius [px]
+
+    // YOLO network is loaded on the first frame whose detections are not cached and shared by all runs of this process
+    ObjectDetector *objectDetector = nullptr; // only used by the detection stage
+    unique_ptr<ArtifactCache> artifactCache;
+    if (options.bUseArtifactCache) artifactCache.reset(new ArtifactCache(options.artifactCacheDir));
+
+    // zero-padded file index of a frame
+    auto imgNumberOf = [&](size_t imgIndex)
+    {
+        ostringstream imgNumber;
+        imgNumber << setfill('0') << setw(imgFillWidth) << imgStartIndex + imgIndex;
+        return imgNumber.str();
+    };
 
     /* MAIN LOOP OVER ALL IMAGES */
 
-    for (size_t imgIndex = 0; imgIndex <= imgEndIndex - imgStartIndex; imgIndex+=imgStepWidth)
-    {
-        /* LOAD IMAGE INTO BUFFER */
+    // every frame passes through the stages below in order; in streaming mode each stage runs on its own thread and
+    // the stages are connected by bounded queues, so e.g. frame N+1 is loaded and run through YOLO while frame N is matched
+    StreamingPipeline<FrameJob> pipeline(2);
 
-        // assemble filenames for current index
-        ostringstream imgNumber;
-        imgNumber << setfill('0') << setw(imgFillWidth) << imgStartIndex + imgIndex;
-        string imgFullFilename = imgBasePath + imgPrefix + imgNumber.str() + imgFileType;
+    // progress output, printed by the tracking stage only
+    ostream nullLog(nullptr); // discards everything
+    ostream &log = options.log ? *options.log : nullLog;
+
+    // per-stage timing and per-frame counters, written as Chrome trace (chrome://tracing, Perfetto) with a latency summary
+    bool bTracing = false;
+    string traceFilename = "trace.json";
+    if (bTracing)
+    {
+        Tracer::instance().clear();
+        Tracer::instance().setEnabled(true);
+    }
+
+    // result images of each tracked object (see VisMode), in ASYNC mode written as PNG files or video streams
+    double visVideoFps = 0; // > 0 writes match.avi and augmented.avi at this frame rate instead of PNG files
+    unique_ptr<VisualizationSink> visSink;
+    if (visMode == VisMode::ASYNC) visSink.reset(new VisualizationSink(visVideoFps));
+
+    size_t nextImgIndex = 0;
+    size_t lastImgIndex = imgEndIndex - imgStartIndex; // relative to imgStartIndex, like FrameJob::imgIndex
+    auto source = [&](FrameJob &job)
+    {
+        if (nextImgIndex > lastImgIndex) return false;
+        job.imgIndex = nextImgIndex;
+        nextImgIndex += imgStepWidth;
+        return true;
+    };
 
-        // load image from file 
-        cv::Mat img = cv::imread(imgFullFilename);
+    pipeline.addStage([&](FrameJob &job)
+    {
+        /* LOAD IMAGE INTO BUFFER */
 
-		// ringbuffer using deque
-		if (dataBuffer.size() >= dataBufferSize) dataBuffer.pop_front();
+        ScopedTimer stageTimer("loadImage");
 
-        // push image into data frame buffer
-        DataFrame frame;
-        frame.cameraImg = img;
-        dataBuffer.push_back(frame);
+        // assemble filenames for current index
+        job.imgNumber = imgNumberOf(job.imgIndex);
+        job.imgFullFilename = imgBasePath + imgPrefix + job.imgNumber + imgFileType;
 
-        cout << "#1 : LOAD IMAGE INTO BUFFER done" << endl;
+        // load image from file (decoded once per process and shared by all runs)
+        job.frame.cameraImg = FrameStore::instance().image(job.imgFullFilename);
 
+        job.log << "#1 : LOAD IMAGE INTO BUFFER done" << endl;
+    });
 
+    pipeline.addStage([&](FrameJob &job)
+    {
         /* DETECT & CLASSIFY OBJECTS */
 
-		double total_time = 0;
+        ScopedTimer stageTimer("detectObjects");
 
         float confThreshold = 0.2;
         float nmsThreshold = 0.4;        
-        detectObjects((dataBuffer.end() - 1)->cameraImg, (dataBuffer.end() - 1)->boundingBoxes, confThreshold, nmsThreshold,
-                      yoloBasePath, yoloClassesFile, yoloModelConfiguration, yoloModelWeights, bVis);
+        ostringstream yoloParams; // everything besides the image which influences the detections
+        yoloParams << yoloModelConfiguration << "|" << yoloModelWeights << "|" << confThreshold << "|" << nmsThreshold;
+        auto artifactKeyOf = [&](const string &imgFilename)
+        {
+            // on disk, the model files are identified by size and modification time as well
+            ostringstream artifactParams;
+            artifactParams << ArtifactCache::fileVersion(yoloModelConfiguration) << "|" << ArtifactCache::fileVersion(yoloModelWeights)
+                           << "|" << confThreshold << "|" << nmsThreshold;
+            return ArtifactCache::makeKey(imgFilename, "YOLO", artifactParams.str());
+        };
+
+        // the detections on each image are computed once per process and shared by all runs through the frame store;
+        // frames which are in neither store nor artifact cache are passed to the network
+        auto detect = [&](const string &imgFilename, const cv::Mat &img)
+        {
+            vector<BoundingBox> bBoxes;
+            string yoloKey = artifactCache ? artifactKeyOf(imgFilename) : "";
+            if (!(artifactCache && artifactCache->loadBoundingBoxes(yoloKey, bBoxes)))
+            {
+                if (!objectDetector) objectDetector = &ObjectDetector::shared(yoloClassesFile, yoloModelConfiguration, yoloModelWeights);
+                ScopedTimer timer("yoloInference");
+                objectDetector->detect(img, bBoxes, confThreshold, nmsThreshold, bVis);
+                if (artifactCache) artifactCache->storeBoundingBoxes(yoloKey, bBoxes);
+            }
+            return bBoxes;
+        };
+        auto storeKeyOf = [&](const string &imgFilename) { return imgFilename + "|" + yoloParams.str(); };
 
-        cout << "#2 : DETECT & CLASSIFY OBJECTS done" << endl;
+        size_t yoloBatchSize = max<size_t>(options.yoloBatchSize, 1);
+        size_t batchPos = (job.imgIndex / imgStepWidth) % yoloBatchSize; // position of current frame within YOLO batch
+        if (yoloBatchSize > 1 && batchPos == 0)
+        {
+            // run all frames of the batch which still need the network through a single forward pass at its first frame,
+            // their images are read ahead from the frame store
+            vector<string> uncachedFilenames;
+            vector<cv::Mat> uncachedImgs;
+            for (size_t batchIndex = job.imgIndex, n = 0; batchIndex <= lastImgIndex && n < yoloBatchSize; batchIndex += imgStepWidth, ++n)
+            {
+                string batchFilename = imgBasePath + imgPrefix + imgNumberOf(batchIndex) + imgFileType;
+                if (FrameStore::instance().hasBoundingBoxes(storeKeyOf(batchFilename))) continue;
+                vector<BoundingBox> bBoxes;
+                if (artifactCache && artifactCache->loadBoundingBoxes(artifactKeyOf(batchFilename), bBoxes))
+                {
+                    FrameStore::instance().boundingBoxes(storeKeyOf(batchFilename), [&]() { return bBoxes; });
+                    continue;
+                }
+                uncachedFilenames.push_back(batchFilename);
+                uncachedImgs.push_back(*FrameStore::instance().image(batchFilename));
+            }
+            if (!uncachedImgs.empty())
+            {
+                if (!objectDetector) objectDetector = &ObjectDetector::shared(yoloClassesFile, yoloModelConfiguration, yoloModelWeights);
+                vector<vector<BoundingBox>> uncachedBoxes;
+                {
+                    ScopedTimer timer("yoloInference");
+                    objectDetector->detectBatch(uncachedImgs, uncachedBoxes, confThreshold, nmsThreshold, bVis);
+                }
+                for (size_t i = 0; i < uncachedFilenames.size(); ++i)
+                {
+                    FrameStore::instance().boundingBoxes(storeKeyOf(uncachedFilenames[i]), [&]() { return uncachedBoxes[i]; });
+                    if (artifactCache) artifactCache->storeBoundingBoxes(artifactKeyOf(uncachedFilenames[i]), uncachedBoxes[i]);
+                }
+            }
+        }
+        job.frame.boundingBoxes = *FrameStore::instance().boundingBoxes(storeKeyOf(job.imgFullFilename),
+                                                                        [&]() { return detect(job.imgFullFilename, *job.frame.cameraImg); });
 
+        traceCounter("boundingBoxes", (double)job.frame.boundingBoxes.size());
+        job.log << "#2 : DETECT & CLASSIFY OBJECTS done" << endl;
+    });
 
+    bool bFullLidarScan = false; // process the whole scan instead of cropping it to the ego lane
+    float voxelLeafSize = 0.0f; // voxel-grid downsampling leaf size in [m], 0 disables downsampling
+    VoxelGridFilter voxelFilter(voxelLeafSize);
+    pipeline.addStage([&](FrameJob &job)
+    {
         /* CROP LIDAR POINTS */
 
-        // load 3D Lidar points from file
-        string lidarFullFilename = imgBasePath + lidarPrefix + imgNumber.str() + lidarFileType;
-        std::vector<LidarPoint> lidarPoints;
-        loadLidarFromFile(lidarPoints, lidarFullFilename);
+        ScopedTimer stageTimer("lidarStage");
+        ScopedTimer loadTimer("loadLidar");
 
-        // remove Lidar points based on distance properties
-        float minZ = -1.5, maxZ = -0.9, minX = 2.0, maxX = 20.0, maxY = 2.0, minR = 0.1; // focus on ego lane
-        cropLidarPoints(lidarPoints, minX, maxX, maxY, minZ, maxZ, minR);
+        // load 3D Lidar points from the memory-mapped file, removing points based on distance properties in the same pass
+        // (read and cropped once per process and shared by all runs; a missing or truncated scan fails the run like a missing image)
+        string lidarFullFilename = imgBasePath + lidarPrefix + job.imgNumber + lidarFileType;
+        shared_ptr<const PointCloud> scan;
+        if (bFullLidarScan)
+        {
+            scan = FrameStore::instance().lidarPoints(lidarFullFilename);
+        }
+        else
+        {
+            float minZ = -1.5, maxZ = -0.9, minX = 2.0, maxX = 20.0, maxY = 2.0, minR = 0.1; // focus on ego lane
+            scan = FrameStore::instance().lidarPoints(lidarFullFilename, minX, maxX, maxY, minZ, maxZ, minR);
+        }
     
-        (dataBuffer.end() - 1)->lidarPoints = lidarPoints;
+        // optionally thin out the scan, keeping the closest point per voxel
+        if (voxelLeafSize > 0)
+        {
+            voxelFilter.filter(*scan, job.frame.lidarPoints);
+            job.log << "voxel grid reduced " << scan->size() << " Lidar points to " << job.frame.lidarPoints.size() << endl;
+        }
+        else
+        {
+            job.frame.lidarPoints = *scan;
+        }
 
-        cout << "#3 : CROP LIDAR POINTS done" << endl;
+        // project all remaining points into the image once, clustering and visualization reuse the coordinates
+        lidarCalibration.projectToImage(job.frame.lidarPoints, job.frame.lidarImgPoints);
+        loadTimer.stop();
+        traceCounter("lidarPoints", (double)job.frame.lidarPoints.size());
+
+        job.log << "#3 : CROP LIDAR POINTS done" << endl;
 
 
         /* CLUSTER LIDAR POINT CLOUD */
 
         // associate Lidar points with camera-based ROI
         float shrinkFactor = 0.10; // shrinks each bounding box by the given percentage to avoid 3D object merging at the edges of an ROI
-        clusterLidarWithROI((dataBuffer.end()-1)->boundingBoxes, (dataBuffer.end() - 1)->lidarPoints, shrinkFactor, P_rect_00, R_rect_00, RT);
+        {
+            ScopedTimer timer("clusterLidarWithROI");
+            clusterLidarWithROI(job.frame.boundingBoxes, job.frame.lidarPoints, job.frame.lidarImgPoints, shrinkFactor);
+        }
 
         // Visualize 3D objects
-        bVis = false;
+        bool bVis = false;
         if(bVis)
         {
-            show3DObjects((dataBuffer.end()-1)->boundingBoxes, cv::Size(4.0, 4.0), cv::Size(1000, 1000), false, imgIndex+imgStartIndex);
+            show3DObjects(job.frame.boundingBoxes, cv::Size(4.0, 4.0), cv::Size(1000, 1000), false, job.imgIndex+imgStartIndex);
         }
-        bVis = false;
 
-        cout << "#4 : CLUSTER LIDAR POINT CLOUD done" << endl;
-        
-        
-        // REMOVE THIS LINE BEFORE PROCEEDING WITH THE FINAL PROJECT
-        //continue; // skips directly to the next image without processing what comes beneath
+        job.log << "#4 : CLUSTER LIDAR POINT CLOUD done" << endl;
+    });
 
+    pipeline.addStage([&](FrameJob &job)
+    {
         /* DETECT IMAGE KEYPOINTS */
 
-        // convert current image to grayscale
-        cv::Mat imgGray;
-        cv::cvtColor((dataBuffer.end()-1)->cameraImg, imgGray, cv::COLOR_BGR2GRAY);
+        ScopedTimer stageTimer("keypointStage");
+
+        // convert current image to grayscale once for all detectors and descriptors, kept with the frame
+        cv::Mat &imgGray = job.frame.cameraImgGray;
+        cv::cvtColor(*job.frame.cameraImg, imgGray, cv::COLOR_BGR2GRAY);
+
+        if (bKltTracking)
+        {
+            // keypoints of the previous frame are tracked, kptMatches are the resulting correspondences
+            ScopedTimer timer("trackKeypoints");
+            double t = (double)cv::getTickCount();
+            kltTracker.buildPyramid(imgGray, job.frame.cameraPyramid); // kept with the frame, the tracker tracks from it into the next one
+            kltTracker.track(job.frame.cameraPyramid, job.frame.keypoints, job.frame.kptMatches);
+            size_t nTracked = job.frame.keypoints.size();
+            if (kltTracker.needsDetection())
+            {
+                vector<cv::KeyPoint> detected;
+                features.detect(imgGray, detected, false);
+                kltTracker.addDetections(job.frame.keypoints, detected);
+            }
+            kltTracker.setReference(job.frame.cameraPyramid, job.frame.keypoints);
+            t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+            job.log << "KLT tracking with n=" << nTracked << " tracks, " << job.frame.keypoints.size() - nTracked << " new keypoints in " << 1000 * t / 1.0 << " ms" << endl;
+
+            mapKeypointsToBoxes(job.frame);
+            traceCounter("keypoints", (double)job.frame.keypoints.size());
+            job.log << "#5 : TRACK KEYPOINTS done" << endl;
+            return;
+        }
 
         // extract 2D keypoints from current image
         vector<cv::KeyPoint> keypoints; // create empty feature list for current image
-		double t = (double)cv::getTickCount();
-        //string detectorType = "FAST";
-
-        if (detectorType.compare("SHITOMASI") == 0)
+        cv::Mat descriptors;
+        bool bLimitKpts = false; // optional : limit number of keypoints (helpful for debugging and learning)
+        bool bFusedDescription = features.fusedDetectDescribe() && !bLimitKpts; // describe in the same pass, sharing the scale pyramid
+        bool bDescribed = false;
+        string keypointsKey, descriptorsKey;
+        if (artifactCache)
         {
-			detKeypointsShiTomasi(keypoints, imgGray, false);
-		}
-		else if (detectorType.compare("HARRIS") == 0)
-		{
-			detKeypointsHarris(keypoints, imgGray, false);
-		}
-		else if (detectorType.compare("HARRIS_GFT") == 0)
-		{
-			detKeypointsHarrisWithGoodFeaturesToTrack(keypoints, imgGray, false);
-		}
-		else
-		{
-			detKeypointsModern(keypoints, img, detectorType, false);
-		}
-		t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
-		cout << detectorType << " detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
-		total_time += t;
+            string keypointsParams = detectorType + features.detectionTiling().key() + (bLimitKpts ? "|limited" : "") + (bFusedDescription ? "|fused" : "");
+            keypointsKey = ArtifactCache::makeKey(job.imgFullFilename, "KEYPOINTS", keypointsParams);
+            descriptorsKey = ArtifactCache::makeKey(job.imgFullFilename, "DESCRIPTORS", keypointsParams + "|" + descriptorType);
+        }
 
-        // optional : limit number of keypoints (helpful for debugging and learning)
-        bool bLimitKpts = false;
-        if (bLimitKpts)
+        // a previous run with the same detector may have stored the keypoints, or with the same detector/descriptor both keypoints and descriptors
+        bool bDescriptorsCached = artifactCache && artifactCache->loadDescriptors(descriptorsKey, keypoints, descriptors);
+        bool bKeypointsCached = bDescriptorsCached || (artifactCache && artifactCache->loadKeypoints(keypointsKey, keypoints));
+        if (!bKeypointsCached)
         {
-            int maxKeypoints = 50;
+            ScopedTimer timer(bFusedDescription && !bDescriptorsCached ? "detectAndDescribeKeypoints" : "detectKeypoints");
+            double t = (double)cv::getTickCount();
+            //string detectorType = "FAST";
+            if (bFusedDescription && !bDescriptorsCached)
+            {
+                features.detectAndDescribe(imgGray, keypoints, descriptors);
+                bDescribed = true;
+            }
+            else
+            {
+                features.detect(imgGray, keypoints, false);
+            }
+            t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+            job.log << detectorType << (bDescribed ? "/" + descriptorType : "") << " detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
+
+            if (bLimitKpts)
+            {
+                int maxKeypoints = 50;
 
-            if (detectorType.compare("SHITOMASI") == 0)
-            { // there is no response info, so keep the first 50 as they are sorted in descending quality order
-                keypoints.erase(keypoints.begin() + maxKeypoints, keypoints.end());
+                if (features.detectorType() == DetectorType::SHITOMASI)
+                { // there is no response info, so keep the first 50 as they are sorted in descending quality order
+                    keypoints.erase(keypoints.begin() + maxKeypoints, keypoints.end());
+                }
+                cv::KeyPointsFilter::retainBest(keypoints, maxKeypoints);
+                job.log << " NOTE: Keypoints have been limited!" << endl;
             }
-            cv::KeyPointsFilter::retainBest(keypoints, maxKeypoints);
-            cout << " NOTE: Keypoints have been limited!" << endl;
+
+            if (artifactCache) artifactCache->storeKeypoints(keypointsKey, keypoints);
         }
 
         // push keypoints and descriptor for current frame to end of data buffer
-        (dataBuffer.end() - 1)->keypoints = keypoints;
+        job.frame.keypoints = keypoints;
 
-        cout << "#5 : DETECT KEYPOINTS done" << endl;
+        job.log << "#5 : DETECT KEYPOINTS done" << endl;
 
 
         /* EXTRACT KEYPOINT DESCRIPTORS */
 
-        cv::Mat descriptors;
         //string descriptorType = "BRISK"; // BRISK, BRIEF, ORB, FREAK, AKAZE, SIFT
-		t = (double)cv::getTickCount();
-        descKeypoints((dataBuffer.end() - 1)->keypoints, (dataBuffer.end() - 1)->cameraImg, descriptors, descriptorType);
-		t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
-		cout << descriptorType << " descriptor extraction in " << 1000 * t / 1.0 << " ms" << endl;
-		total_time += t;
+        if (!bDescriptorsCached)
+        {
+            if (!bDescribed)
+            {
+                ScopedTimer timer("describeKeypoints");
+                double t = (double)cv::getTickCount();
+                features.describe(job.frame.keypoints, imgGray, descriptors);
+                t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+                job.log << descriptorType << " descriptor extraction in " << 1000 * t / 1.0 << " ms" << endl;
+            }
+
+            // descriptor extraction may remove keypoints, so they are stored along with the descriptors
+            if (artifactCache) artifactCache->storeDescriptors(descriptorsKey, job.frame.keypoints, descriptors);
+        }
 
         // push descriptors for current frame to end of data buffer
-        (dataBuffer.end() - 1)->descriptors = descriptors;
+        job.frame.descriptors = descriptors;
+
+        // the FLANN index of the current frame is built here, off the tracking thread; guided matching
+        // searches its candidate windows directly and does not need it
+        if (!bGuidedMatching) job.frame.descriptorIndex = features.buildIndex(job.frame.descriptors);
+
+        // boxes enclosing each keypoint, shared by bounding box tracking and match clustering
+        mapKeypointsToBoxes(job.frame);
+        traceCounter("keypoints", (double)job.frame.keypoints.size());
 
-        cout << "#6 : EXTRACT DESCRIPTORS done" << endl;
+        job.log << "#6 : EXTRACT DESCRIPTORS done" << endl;
+    });
 
+    // needs the previous frame, runs on the calling thread so that result windows are shown from there
+    pipeline.addStage([&](FrameJob &job)
+    {
+        ScopedTimer stageTimer("trackingStage");
+        size_t imgIndex = job.imgIndex;
+        log << job.log.str();
+
+		// ringbuffer using deque
+		if (dataBuffer.size() >= dataBufferSize) dataBuffer.pop_front();
+
+        // push data frame into buffer
+        dataBuffer.push_back(std::move(job.frame));
 
         if (dataBuffer.size() > 1) // wait until at least two images have been processed
         {
@@ -222,38 +480,50 @@ int run(std::string detectorType, std::string descriptorType, std::vector<float>
             /* MATCH KEYPOINT DESCRIPTORS */
 
             vector<cv::DMatch> matches;
-            string matcherType = "MAT_BF";        // MAT_BF, MAT_FLANN
-			string matcherDescriptorType = "DES_BINARY"; // DES_BINARY, DES_HOG
-			if (descriptorType == "SIFT") matcherDescriptorType = "DES_HOG"; // SIFT uses float
-			string selectorType = "SEL_KNN";       // SEL_NN, SEL_KNN
 
 			double t = (double)cv::getTickCount();
-
-            matchDescriptors((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints,
-                             (dataBuffer.end() - 2)->descriptors, (dataBuffer.end() - 1)->descriptors,
-                             matches, matcherDescriptorType, matcherType, selectorType);
-
+            ScopedTimer matchTimer("matchDescriptors");
+
+            DataFrame &prevFrame = *(dataBuffer.end() - 2), &currFrame = *(dataBuffer.end() - 1);
+            if (bKltTracking)
+                matches = currFrame.kptMatches; // already tracked by the keypoint stage
+            else if (bGuidedMatching && prevFrame.kptMotionSupport > 0) // no motion estimate yet for the first frame pair
+                matchDescriptorsGuided(prevFrame, currFrame, guidedSearchRadius, matches);
+            else if (currFrame.descriptorIndex)
+                features.match(prevFrame.descriptors, *currFrame.descriptorIndex, matches);
+            else
+                features.match(prevFrame.descriptors, currFrame.descriptors, matches);
+
+            matchTimer.stop();
+            traceCounter("kptMatches", (double)matches.size());
 			t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
-			cout << matcherType << " " << selectorType << " with n=" << matches.size() << " matches in " << 1000 * t / 1.0 << " ms" << endl;
+			log << (bKltTracking ? string("KLT") : matcherType + " " + selectorType) << " with n=" << matches.size() << " matches in " << 1000 * t / 1.0 << " ms" << endl;
 
             // store matches in current data frame
             (dataBuffer.end() - 1)->kptMatches = matches;
 
-            cout << "#7 : MATCH KEYPOINT DESCRIPTORS done" << endl;
+            log << "#7 : MATCH KEYPOINT DESCRIPTORS done" << endl;
 
-            
+        
             /* TRACK 3D OBJECT BOUNDING BOXES */
 
             //// STUDENT ASSIGNMENT
             //// TASK FP.1 -> match list of 3D objects (vector<BoundingBox>) between current and previous frame (implement ->matchBoundingBoxes)
             map<int, int> bbBestMatches;
-            matchBoundingBoxes(matches, bbBestMatches, *(dataBuffer.end()-2), *(dataBuffer.end()-1)); // associate bounding boxes between current and previous frame using keypoint matches
+            {
+                ScopedTimer timer("matchBoundingBoxes");
+                matchBoundingBoxes((dataBuffer.end()-1)->kptMatches, bbBestMatches, *(dataBuffer.end()-2), *(dataBuffer.end()-1)); // associate bounding boxes between current and previous frame using keypoint matches
+            }
+            traceCounter("bbMatches", (double)bbBestMatches.size());
             //// EOF STUDENT ASSIGNMENT
 
             // store matches in current data frame
             (dataBuffer.end()-1)->bbMatches = bbBestMatches;
 
-            cout << "#8 : TRACK 3D OBJECT BOUNDING BOXES done" << endl;
+            // per-object keypoint motion, predicts the search windows for the next frame
+            if (bGuidedMatching) estimateKeypointMotion(prevFrame, currFrame);
+
+            log << "#8 : TRACK 3D OBJECT BOUNDING BOXES done" << endl;
 
 
             /* COMPUTE TTC ON OBJECT IN FRONT */
@@ -263,11 +533,13 @@ int run(std::string detectorType, std::string descriptorType, std::vector<float>
             {
                 // find bounding boxes associates with current match
                 BoundingBox *prevBB=nullptr, *currBB=nullptr;
+                int currBBIdx = -1;
                 for (auto it2 = (dataBuffer.end() - 1)->boundingBoxes.begin(); it2 != (dataBuffer.end() - 1)->boundingBoxes.end(); ++it2)
                 {
                     if (it1->second == it2->boxID) // check wether current match partner corresponds to this BB
                     {
                         currBB = &(*it2);
+                        currBBIdx = it2 - (dataBuffer.end() - 1)->boundingBoxes.begin();
                     }
                 }
 
@@ -285,56 +557,87 @@ int run(std::string detectorType, std::string descriptorType, std::vector<float>
                     //// STUDENT ASSIGNMENT
                     //// TASK FP.2 -> compute time-to-collision based on Lidar data (implement -> computeTTCLidar)
                     double ttcLidar; 
-                    computeTTCLidar(prevBB->lidarPoints, currBB->lidarPoints, sensorFrameRate, ttcLidar);
+                    {
+                        ScopedTimer timer("computeTTCLidar");
+                        computeTTCLidar(prevBB->lidarStats, currBB->lidarStats, sensorFrameRate, ttcLidar);
+                    }
                     //// EOF STUDENT ASSIGNMENT
 
                     //// STUDENT ASSIGNMENT
                     //// TASK FP.3 -> assign enclosed keypoint matches to bounding box (implement -> clusterKptMatchesWithROI)
                     //// TASK FP.4 -> compute time-to-collision based on camera (implement -> computeTTCCamera)
-					cv::Mat visImgMatch = (dataBuffer.end() - 1)->cameraImg.clone();
                     double ttcCamera;
-                    clusterKptMatchesWithROI(*currBB, (dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, (dataBuffer.end() - 1)->kptMatches);
-                    computeTTCCamera((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, currBB->kptMatches, sensorFrameRate, ttcCamera, &visImgMatch);
-					{
-						char tmp[20];
-						sprintf(tmp, "match_%02d.png", imgIndex + imgStartIndex);
-						cv::imwrite(tmp, visImgMatch);
-					}
+                    {
+                        ScopedTimer timer("clusterKptMatchesWithROI");
+                        clusterKptMatchesWithROI(currBBIdx, *(dataBuffer.end() - 2), *(dataBuffer.end() - 1));
+                    }
+                    ScopedTimer ttcCameraTimer("computeTTCCamera");
+                    if (bSampledTTCCamera)
+                        computeTTCCameraSampled((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, currBB->kptMatches, sensorFrameRate, ttcCamera, ttcCameraRankError);
+                    else
+                        computeTTCCamera((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, currBB->kptMatches, sensorFrameRate, ttcCamera);
+                    ttcCameraTimer.stop();
+                    if (ttcCameraInputs != nullptr)
+                    {
+                        TTCCameraInput input = { (dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, currBB->kptMatches, sensorFrameRate };
+                        ttcCameraInputs->push_back(input);
+                    }
                     //// EOF STUDENT ASSIGNMENT
 
-                    bVis = true;
-                    if (bVis)
+                    if (visMode != VisMode::HEADLESS)
                     {
-                        cv::Mat visImg = (dataBuffer.end() - 1)->cameraImg.clone();
-                        showLidarImgOverlay(visImg, currBB->lidarPoints, P_rect_00, R_rect_00, RT, &visImg);
-                        cv::rectangle(visImg, cv::Point(currBB->roi.x, currBB->roi.y), cv::Point(currBB->roi.x + currBB->roi.width, currBB->roi.y + currBB->roi.height), cv::Scalar(0, 255, 0), 2);
-                        
+                        ScopedTimer timer("visualizeResults");
+                        int frameNo = (int)(imgIndex + imgStartIndex);
+                        const cv::Mat &currImg = *(dataBuffer.end() - 1)->cameraImg;
+
+                        // keypoint motion of the object
+                        VisFrame matchFrame("match", frameNo, currImg);
+                        for (auto &match : currBB->kptMatches)
+                            matchFrame.line((dataBuffer.end() - 2)->keypoints[match.queryIdx].pt, (dataBuffer.end() - 1)->keypoints[match.trainIdx].pt, cv::Scalar(255, 255, 0), 1);
+
+                        VisFrame augmentedFrame("augmented", frameNo, currImg);
+                        augmentedFrame.lidarOverlay(currBB->lidarPoints, currBB->lidarImgPoints);
+                        augmentedFrame.rectangle(currBB->roi, cv::Scalar(0, 255, 0), 2);
                         char str[200];
                         sprintf(str, "TTC Lidar : %f s, TTC Camera : %f s", ttcLidar, ttcCamera);
-                        putText(visImg, str, cv::Point2f(80, 50), cv::FONT_HERSHEY_PLAIN, 2, cv::Scalar(0,0,255));
-
-						{
-							// save image
-							char tmp[20];
-							sprintf(tmp, "augmented_%02d.png", imgIndex+imgStartIndex);
-							cv::imwrite(tmp, visImg);
-						}
-
-                        string windowName = "Final Results : TTC";
-                        cv::namedWindow(windowName, 4);
-                        cv::imshow(windowName, visImg);
-                        cout << "Press key to continue to next frame" << endl;
-                        cv::waitKey(0);
+                        augmentedFrame.text(str, cv::Point2f(80, 50), 2, cv::Scalar(0, 0, 255));
+
+                        if (visSink)
+                        {
+                            visSink->submit(matchFrame);
+                            visSink->submit(augmentedFrame);
+                        }
+                        else
+                        {
+                            cv::imwrite(matchFrame.filename(), matchFrame.render());
+                            cv::Mat visImg = augmentedFrame.render();
+                            cv::imwrite(augmentedFrame.filename(), visImg);
+
+                            string windowName = "Final Results : TTC";
+                            cv::namedWindow(windowName, 4);
+                            cv::imshow(windowName, visImg);
+                            log << "Press key to continue to next frame" << endl;
+                            cv::waitKey(0);
+                        }
                     }
-                    bVis = false;
 
 					if (TTCEstimates!=nullptr) TTCEstimates->push_back(ttcCamera);
                 } // eof TTC computation
             } // eof loop over all BB matches            
 
         }
+    });
+
+    if (options.bStreamingPipeline) pipeline.run(source);
+    else pipeline.runSequential(source);
+    visSink.reset(); // waits until the remaining result images are written
 
-    } // eof loop over all images
+    if (bTracing)
+    {
+        Tracer::instance().setEnabled(false);
+        if (!Tracer::instance().writeChromeTrace(traceFilename)) cerr << "cannot write " << traceFilename << endl;
+        Tracer::instance().printSummary(log);
+    }
 
     return 0;
 }
@@ -347,23 +650,7 @@ void gen_report()
 	//vector<string> all_detectors = { "ORB", "AKAZE", "SIFT" };
 	vector<string> all_descriptors = { "BRISK", "BRIEF","ORB", "FREAK", "AKAZE", "SIFT" };
 
-	FILE *fLogFile;
-
-	fopen_s(&(fLogFile), "ttc_camera.log", "wt");
-	// headers:
-	int num_frames = 18;
-	int i;
-	for (i=0;i<num_frames;i++)
-	{
-		fprintf(fLogFile , "| %d", i + 1);
-	}
-	fprintf(fLogFile, "\n---");
-	for (i = 0; i < num_frames; i++)
-	{
-		fprintf(fLogFile, "|---");
-	}
-	fprintf(fLogFile, "\n");
-	
+	vector<SweepJob> jobs;
 	for (auto detectorType : all_detectors)
 	{
 		for (auto descriptorType : all_descriptors)
@@ -378,22 +665,186 @@ void gen_report()
 				// invalid combination: keypoint octave is too high, it'll cause memory full
 				continue;
 			}
-			std::vector<float> TTCEstimates;
-			run(detectorType, descriptorType, &TTCEstimates);
-			fprintf(fLogFile, "%s+%s", detectorType.c_str(), descriptorType.c_str());
-			for (i = 0; i < num_frames; i++)
+			SweepJob job;
+			job.detectorType = detectorType;
+			job.descriptorType = descriptorType;
+			jobs.push_back(job);
+		}
+	}
+
+	// the first combination runs alone and computes the YOLO detections, which all others take from the frame store;
+	// those run concurrently, each one fills its own result buffer and processes its frames sequentially instead of
+	// starting a streaming pipeline
+	runSweep(jobs, [](SweepJob &job)
+	{
+		RunOptions options;
+		options.bStreamingPipeline = !job.bConcurrent;
+		options.bUseArtifactCache = true; // a repeated sweep skips YOLO, keypoint detection and description
+		options.yoloBatchSize = 4; // only the first job runs the network, the others take its detections from the frame store
+		if (job.bConcurrent) options.log = nullptr; // the progress of concurrent jobs would interleave
+		run(job.detectorType, job.descriptorType, &job.TTCEstimates, VisMode::HEADLESS, nullptr, options);
+	});
+
+	// results are written in the order of the combinations, independent of which job finished first
+	FILE *fLogFile = fopen("ttc_camera.log", "wt");
+	if (fLogFile == nullptr)
+	{
+		cerr << "cannot open ttc_camera.log" << endl;
+		return;
+	}
+	// headers:
+	size_t num_frames = 18;
+	size_t i;
+	for (i=0;i<num_frames;i++)
+	{
+		fprintf(fLogFile , "| %d", (int)i + 1);
+	}
+	fprintf(fLogFile, "\n---");
+	for (i = 0; i < num_frames; i++)
+	{
+		fprintf(fLogFile, "|---");
+	}
+	fprintf(fLogFile, "\n");
+	
+	for (auto &job : jobs)
+	{
+		fprintf(fLogFile, "%s+%s", job.detectorType.c_str(), job.descriptorType.c_str());
+		for (i = 0; i < num_frames; i++)
+		{
+			if (i < job.TTCEstimates.size()) fprintf(fLogFile, "| %.2f", job.TTCEstimates[i]);
+			else fprintf(fLogFile, "| -");
+		}
+		if (!job.error.empty()) fprintf(fLogFile, "| %s", job.error.c_str());
+		fprintf(fLogFile, "\n");
+	}
+	fclose(fLogFile);
+}
+
+// compares the sampled camera TTC estimator with the exact one on the object correspondences of the KITTI sequence
+void benchmark_ttc_camera()
+{
+	vector<TTCCameraInput> inputs;
+	run("FAST", "BRIEF", nullptr, VisMode::HEADLESS, &inputs); // FAST yields the largest no. of matches per object
+
+	vector<float> rankErrors = { 0.05f, 0.02f, defaultTTCCameraRankError };
+	const int nRepeats = 5;
+	cout << "frame | matches | exact TTC [s] | exact [ms]";
+	for (float rankError : rankErrors) cout << " | sampled " << rankError << " TTC [s] | [ms] | achieved rank error";
+	cout << endl;
+
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		TTCCameraInput &input = inputs[i];
+		double ttcExact = 0;
+		double t = (double)cv::getTickCount();
+		for (int r = 0; r < nRepeats; ++r)
+			computeTTCCamera(input.kptsPrev, input.kptsCurr, input.kptMatches, input.frameRate, ttcExact);
+		t = ((double)cv::getTickCount() - t) / cv::getTickFrequency() / nRepeats;
+		cout << i + 1 << " | " << input.kptMatches.size() << " | " << ttcExact << " | " << 1000 * t;
+
+		for (float rankError : rankErrors)
+		{
+			double ttcSampled = 0;
+			float achievedRankError = 0;
+			t = (double)cv::getTickCount();
+			for (int r = 0; r < nRepeats; ++r)
+				computeTTCCameraSampled(input.kptsPrev, input.kptsCurr, input.kptMatches, input.frameRate, ttcSampled, rankError, nullptr, &achievedRankError);
+			t = ((double)cv::getTickCount() - t) / cv::getTickFrequency() / nRepeats;
+			cout << " | " << ttcSampled << " | " << 1000 * t << " | " << achievedRankError;
+		}
+		cout << endl;
+	}
+
+	// the exact estimator holds all n*(n-1)/2 distance pairs, the sampled one at most its sample size in ratios
+	size_t maxMatches = 0;
+	for (auto &input : inputs) maxMatches = max(maxMatches, input.kptMatches.size());
+	if (maxMatches < 2) return;
+	cout << "peak pair storage for " << maxMatches << " matches: exact " << maxMatches * (maxMatches - 1) / 2 * sizeof(pair<float, float>) / 1024 << " KB";
+	for (float rankError : rankErrors)
+		cout << ", sampled <= " << ttcCameraSampleSize(rankError) * sizeof(float) / 1024 << " KB";
+	cout << endl;
+}
+
+// compares the fused Hamming matcher with OpenCV's brute-force kNN matching followed by the ratio test on
+// consecutive KITTI frames, for binary descriptors of 32 (BRIEF, ORB) and 64 bytes (BRISK)
+void benchmark_hamming_matcher()
+{
+	string imgPrefix = "../images/KITTI/2011_09_26/image_02/data/000000";
+	const int nFrames = 18, nRepeats = 5;
+	vector<string> descriptorTypes = { "BRIEF", "ORB", "BRISK" };
+
+	cout << "fused matcher kernel: " << hammingMatcherKernel() << endl;
+	cout << "descriptor | bytes | frame | descriptors | matches | identical | OpenCV [ms] | fused [ms]" << endl;
+	for (auto descriptorType : descriptorTypes)
+	{
+		FeaturePipeline features("FAST", descriptorType);
+		cv::Ptr<cv::DescriptorMatcher> matcher = createMatcher(MatcherType::MAT_BF, true, SelectorType::SEL_KNN);
+		vector<vector<cv::DMatch>> knnMatches;
+		double tOpenCV = 0, tFused = 0;
+
+		cv::Mat prevDescriptors;
+		for (int i = 0; i <= nFrames; ++i)
+		{
+			ostringstream imgNumber;
+			imgNumber << setfill('0') << setw(4) << i;
+			cv::Mat imgGray;
+			cv::cvtColor(*FrameStore::instance().image(imgPrefix + imgNumber.str() + ".png"), imgGray, cv::COLOR_BGR2GRAY);
+
+			vector<cv::KeyPoint> keypoints;
+			cv::Mat descriptors;
+			features.detect(imgGray, keypoints);
+			features.describe(keypoints, imgGray, descriptors);
+
+			if (i > 0)
 			{
-				fprintf(fLogFile, "| %.2f", TTCEstimates[i]);
+				// current path: k=2 lists, then the ratio test of selectMatches()
+				vector<cv::DMatch> matchesOpenCV, matchesFused;
+				double t = (double)cv::getTickCount();
+				for (int r = 0; r < nRepeats; ++r)
+				{
+					matchesOpenCV.clear();
+					matcher->knnMatch(prevDescriptors, descriptors, knnMatches, 2);
+					for (auto &knn : knnMatches)
+						if (knn.size() >= 2 && knn[0].distance < 0.8 * knn[1].distance) matchesOpenCV.push_back(knn[0]);
+				}
+				t = ((double)cv::getTickCount() - t) / cv::getTickFrequency() / nRepeats;
+				tOpenCV += t;
+
+				double tf = (double)cv::getTickCount();
+				for (int r = 0; r < nRepeats; ++r)
+					matchHammingKnnRatio(prevDescriptors, descriptors, matchesFused);
+				tf = ((double)cv::getTickCount() - tf) / cv::getTickFrequency() / nRepeats;
+				tFused += tf;
+
+				bool bIdentical = matchesOpenCV.size() == matchesFused.size();
+				for (size_t m = 0; bIdentical && m < matchesFused.size(); ++m)
+					bIdentical = matchesOpenCV[m].queryIdx == matchesFused[m].queryIdx && matchesOpenCV[m].trainIdx == matchesFused[m].trainIdx &&
+								 matchesOpenCV[m].distance == matchesFused[m].distance;
+
+				cout << descriptorType << " | " << descriptors.cols << " | " << i << " | " << prevDescriptors.rows << " x " << descriptors.rows
+					 << " | " << matchesFused.size() << " | " << (bIdentical ? "yes" : "NO") << " | " << 1000 * t << " | " << 1000 * tf << endl;
 			}
-			fprintf(fLogFile, "\n");
-			fflush(fLogFile);
+			prevDescriptors = descriptors;
 		}
+		cout << descriptorType << " total: OpenCV " << 1000 * tOpenCV << " ms, fused " << 1000 * tFused << " ms, speedup " << tOpenCV / tFused << endl;
 	}
-	fclose(fLogFile);
 }
 
+// usage: 3D_object_tracking [--bench-hamming | --bench-ttc-camera]
 int main(int argc, const char *argv[])
 {
+	string mode = argc > 1 ? argv[1] : "";
+	if (mode == "--bench-hamming")
+	{
+		benchmark_hamming_matcher();
+		return 0;
+	}
+	if (mode == "--bench-ttc-camera")
+	{
+		benchmark_ttc_camera();
+		return 0;
+	}
+
 	//run("ORB", "BRIEF");
 	run("FAST", "BRIEF");
 }
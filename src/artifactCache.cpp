@@ -0,0 +1,281 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "artifactCache.hpp"
+#include "mappedFile.hpp"
+
+using namespace std;
+
+// every artifact file starts with magic, version, stage and the full key, followed by the stage specific payload
+static const char artifactMagic[8] = { 'S', 'F', 'N', 'D', 'A', 'R', 'T', '\0' };
+static const uint32_t artifactVersion = 2; // increment whenever the layout of any payload or the way it is computed changes
+
+enum ArtifactStage { STAGE_BOUNDING_BOXES = 1, STAGE_KEYPOINTS = 2, STAGE_DESCRIPTORS = 3 };
+
+// serialized sizes of the payload records
+static const size_t boundingBoxRecordSize = 6 * sizeof(int32_t) + sizeof(BoundingBox::confidence);
+static const size_t keypointRecordSize = 5 * sizeof(float) + 2 * sizeof(int32_t);
+
+// bounds-checked sequential reader on top of a mapped artifact
+struct ArtifactReader
+{
+    const unsigned char *pos;
+    const unsigned char *end;
+
+    bool read(void *dst, size_t n)
+    {
+        if ((size_t)(end - pos) < n) return false;
+        memcpy(dst, pos, n);
+        pos += n;
+        return true;
+    }
+    template <typename T> bool read(T &value) { return read(&value, sizeof(T)); }
+
+    // checks a count read from the file before anything is allocated for it
+    bool fits(uint64_t count, size_t recordSize) const { return count <= (uint64_t)(end - pos) / recordSize; }
+};
+
+// artifact payload is assembled in memory and written with a single call
+struct ArtifactWriter
+{
+    vector<unsigned char> buffer;
+
+    void write(const void *src, size_t n)
+    {
+        const unsigned char *p = (const unsigned char *)src;
+        buffer.insert(buffer.end(), p, p + n);
+    }
+    template <typename T> void write(const T &value) { write(&value, sizeof(T)); }
+};
+
+// 64 bit FNV-1a hash, used to derive the artifact filename from its key
+static uint64_t hashKey(const string &key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void writeHeader(ArtifactWriter &writer, const string &key, uint32_t stage)
+{
+    writer.write(artifactMagic, sizeof(artifactMagic));
+    writer.write(artifactVersion);
+    writer.write(stage);
+    writer.write((uint32_t)key.size());
+    writer.write(key.data(), key.size());
+}
+
+// checks magic, version, stage and key; on success the reader is positioned at the payload
+static bool readHeader(ArtifactReader &reader, const string &key, uint32_t stage)
+{
+    char magic[sizeof(artifactMagic)];
+    uint32_t version, fileStage, keyLength;
+    if (!reader.read(magic, sizeof(magic)) || memcmp(magic, artifactMagic, sizeof(magic)) != 0) return false;
+    if (!reader.read(version) || version != artifactVersion) return false;
+    if (!reader.read(fileStage) || fileStage != stage) return false;
+    if (!reader.read(keyLength) || keyLength != key.size()) return false;
+    if ((size_t)(reader.end - reader.pos) < keyLength || memcmp(reader.pos, key.data(), keyLength) != 0) return false; // hash collision
+    reader.pos += keyLength;
+    return true;
+}
+
+static void writeKeypoints(ArtifactWriter &writer, const vector<cv::KeyPoint> &keypoints)
+{
+    writer.write((uint32_t)keypoints.size());
+    for (auto &kp : keypoints)
+    {
+        writer.write(kp.pt.x); writer.write(kp.pt.y);
+        writer.write(kp.size); writer.write(kp.angle); writer.write(kp.response);
+        writer.write((int32_t)kp.octave); writer.write((int32_t)kp.class_id);
+    }
+}
+
+static bool readKeypoints(ArtifactReader &reader, vector<cv::KeyPoint> &keypoints)
+{
+    uint32_t count;
+    if (!reader.read(count) || !reader.fits(count, keypointRecordSize)) return false;
+    keypoints.resize(count);
+    for (auto &kp : keypoints)
+    {
+        int32_t octave, classId;
+        if (!(reader.read(kp.pt.x) && reader.read(kp.pt.y) && reader.read(kp.size) && reader.read(kp.angle) &&
+              reader.read(kp.response) && reader.read(octave) && reader.read(classId))) return false;
+        kp.octave = octave;
+        kp.class_id = classId;
+    }
+    return true;
+}
+
+// write to a temporary file first and rename it, so concurrent readers never see a partially written artifact
+static void writeArtifact(const string &filename, const ArtifactWriter &writer)
+{
+    ostringstream tmpFilename;
+#ifdef _WIN32
+    tmpFilename << filename << "." << _getpid();
+#else
+    tmpFilename << filename << "." << getpid();
+#endif
+    tmpFilename << "." << hash<thread::id>()(this_thread::get_id()) << ".tmp";
+
+    FILE *stream = fopen(tmpFilename.str().c_str(), "wb");
+    if (stream == nullptr)
+    {
+        cerr << "artifact cache: cannot write " << tmpFilename.str() << endl;
+        return;
+    }
+    bool ok = fwrite(writer.buffer.data(), 1, writer.buffer.size(), stream) == writer.buffer.size();
+    ok = (fclose(stream) == 0) && ok;
+    if (!ok || rename(tmpFilename.str().c_str(), filename.c_str()) != 0)
+    {
+        remove(tmpFilename.str().c_str()); // another writer may have stored the same artifact in the meantime
+    }
+}
+
+ArtifactCache::ArtifactCache(std::string cacheDir) : cacheDir(cacheDir)
+{
+#ifdef _WIN32
+    _mkdir(cacheDir.c_str());
+#else
+    mkdir(cacheDir.c_str(), 0755);
+#endif
+}
+
+std::string ArtifactCache::makeKey(const std::string &inputFile, const std::string &stage, const std::string &params)
+{
+    ostringstream key;
+    key << fileVersion(inputFile) << "|" << stage << "|" << params;
+    return key.str();
+}
+
+std::string ArtifactCache::fileVersion(const std::string &file)
+{
+    // file size and modification time invalidate the artifacts when a file is replaced
+    struct stat st;
+    long long fileSize = -1, fileTime = -1;
+    if (stat(file.c_str(), &st) == 0)
+    {
+        fileSize = (long long)st.st_size;
+        fileTime = (long long)st.st_mtime;
+    }
+    ostringstream version;
+    version << file << "|" << fileSize << "|" << fileTime;
+    return version.str();
+}
+
+std::string ArtifactCache::artifactFilename(const std::string &key) const
+{
+    ostringstream filename;
+    filename << cacheDir << "/" << hex << setfill('0') << setw(16) << hashKey(key) << ".bin";
+    return filename.str();
+}
+
+bool ArtifactCache::loadBoundingBoxes(const std::string &key, std::vector<BoundingBox> &bBoxes)
+{
+    MappedFile file(artifactFilename(key));
+    ArtifactReader reader = { file.data(), file.data() + file.size() };
+    if (file.data() == nullptr || !readHeader(reader, key, STAGE_BOUNDING_BOXES)) return false;
+
+    uint32_t count;
+    if (!reader.read(count) || !reader.fits(count, boundingBoxRecordSize)) return false;
+    vector<BoundingBox> loaded(count);
+    for (auto &bBox : loaded)
+    {
+        int32_t boxID, x, y, width, height, classID;
+        if (!(reader.read(boxID) && reader.read(x) && reader.read(y) && reader.read(width) && reader.read(height) &&
+              reader.read(classID) && reader.read(bBox.confidence))) return false;
+        bBox.boxID = boxID;
+        bBox.roi = cv::Rect(x, y, width, height);
+        bBox.classID = classID;
+    }
+    bBoxes.insert(bBoxes.end(), loaded.begin(), loaded.end());
+    return true;
+}
+
+void ArtifactCache::storeBoundingBoxes(const std::string &key, const std::vector<BoundingBox> &bBoxes)
+{
+    ArtifactWriter writer;
+    writeHeader(writer, key, STAGE_BOUNDING_BOXES);
+    writer.write((uint32_t)bBoxes.size());
+    for (auto &bBox : bBoxes)
+    {
+        writer.write((int32_t)bBox.boxID);
+        writer.write((int32_t)bBox.roi.x); writer.write((int32_t)bBox.roi.y);
+        writer.write((int32_t)bBox.roi.width); writer.write((int32_t)bBox.roi.height);
+        writer.write((int32_t)bBox.classID);
+        writer.write(bBox.confidence);
+    }
+    writeArtifact(artifactFilename(key), writer);
+}
+
+bool ArtifactCache::loadKeypoints(const std::string &key, std::vector<cv::KeyPoint> &keypoints)
+{
+    MappedFile file(artifactFilename(key));
+    ArtifactReader reader = { file.data(), file.data() + file.size() };
+    if (file.data() == nullptr || !readHeader(reader, key, STAGE_KEYPOINTS)) return false;
+
+    vector<cv::KeyPoint> loaded;
+    if (!readKeypoints(reader, loaded)) return false;
+    keypoints.swap(loaded);
+    return true;
+}
+
+void ArtifactCache::storeKeypoints(const std::string &key, const std::vector<cv::KeyPoint> &keypoints)
+{
+    ArtifactWriter writer;
+    writeHeader(writer, key, STAGE_KEYPOINTS);
+    writeKeypoints(writer, keypoints);
+    writeArtifact(artifactFilename(key), writer);
+}
+
+bool ArtifactCache::loadDescriptors(const std::string &key, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors)
+{
+    MappedFile file(artifactFilename(key));
+    ArtifactReader reader = { file.data(), file.data() + file.size() };
+    if (file.data() == nullptr || !readHeader(reader, key, STAGE_DESCRIPTORS)) return false;
+
+    vector<cv::KeyPoint> loadedKeypoints;
+    if (!readKeypoints(reader, loadedKeypoints)) return false;
+    int32_t rows, cols, type;
+    if (!(reader.read(rows) && reader.read(cols) && reader.read(type))) return false;
+    // only binary and float descriptors are ever stored
+    if (rows < 0 || cols < 0 || (type != CV_8UC1 && type != CV_32FC1)) return false;
+    size_t elemSize = CV_ELEM_SIZE(type);
+    if (cols > 0 && !reader.fits(rows, (size_t)cols * elemSize)) return false;
+    cv::Mat loaded(rows, cols, type);
+    size_t dataSize = loaded.total() * elemSize;
+    if (dataSize > 0 && !reader.read(loaded.data, dataSize)) return false;
+    keypoints.swap(loadedKeypoints);
+    descriptors = loaded;
+    return true;
+}
+
+void ArtifactCache::storeDescriptors(const std::string &key, const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors)
+{
+    cv::Mat continuous = descriptors.isContinuous() ? descriptors : descriptors.clone();
+
+    ArtifactWriter writer;
+    writeHeader(writer, key, STAGE_DESCRIPTORS);
+    writeKeypoints(writer, keypoints);
+    writer.write((int32_t)continuous.rows);
+    writer.write((int32_t)continuous.cols);
+    writer.write((int32_t)continuous.type());
+    writer.write(continuous.data, continuous.total() * continuous.elemSize());
+    writeArtifact(artifactFilename(key), writer);
+}
@@ -0,0 +1,42 @@
+
+#ifndef artifactCache_hpp
+#define artifactCache_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "dataStructures.h"
+
+// On-disk cache of per-frame artifacts (YOLO detections, keypoints and descriptors) which are identical
+// across repeated runs over the same images. Each artifact is stored in its own versioned binary file,
+// named after a hash of its key, and is memory-mapped when read back. Artifact files which are truncated or corrupt
+// are treated as cache misses.
+class ArtifactCache
+{
+public:
+    explicit ArtifactCache(std::string cacheDir);
+
+    // assembles a cache key from the input file (including its size and modification time), the pipeline stage and its parameters
+    static std::string makeKey(const std::string &inputFile, const std::string &stage, const std::string &params);
+    // filename, size and modification time of a file, for parameters which are files themselves (e.g. model weights)
+    static std::string fileVersion(const std::string &file);
+
+    bool loadBoundingBoxes(const std::string &key, std::vector<BoundingBox> &bBoxes);
+    void storeBoundingBoxes(const std::string &key, const std::vector<BoundingBox> &bBoxes);
+
+    bool loadKeypoints(const std::string &key, std::vector<cv::KeyPoint> &keypoints);
+    void storeKeypoints(const std::string &key, const std::vector<cv::KeyPoint> &keypoints);
+
+    // descriptors are stored together with their keypoints, as descriptor extraction may remove keypoints
+    bool loadDescriptors(const std::string &key, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
+    void storeDescriptors(const std::string &key, const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors);
+
+private:
+    std::string artifactFilename(const std::string &key) const;
+
+    std::string cacheDir;
+};
+
+#endif /* artifactCache_hpp */
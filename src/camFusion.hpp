@@ -8,14 +8,30 @@
 #include "dataStructures.h"
 
 
-void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, const PointCloud &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, const PointCloud &lidarPoints, std::vector<cv::Point> &lidarImgPoints, float shrinkFactor);
 void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches);
+void clusterKptMatchesWithROI(int boxIdx, DataFrame &prevFrame, DataFrame &currFrame);
+void mapKeypointsToBoxes(DataFrame &frame);
 void matchBoundingBoxes(std::vector<cv::DMatch> &matches, std::map<int, int> &bbBestMatches, DataFrame &prevFrame, DataFrame &currFrame);
 
+void computeLidarStats(const PointCloudView &lidarPoints, LidarStats &stats);
+
 void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize, cv::Size imageSize, bool bWait=true, int nFrameCounter=0);
 
 void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr,
                       std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC, cv::Mat *visImg=nullptr);
-void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
-                     std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC);                  
+// Median distance ratio over a sample of ttcCameraSampleSize(rankError) pairs, memory is bounded by the sample size.
+// Pairs are drawn until the sample is full, but at most 20 times its size; if too few pairs pass the distance filter
+// for that, the median of the smaller sample is used and achievedRankError is the (larger) bound it guarantees.
+// If all pairs fit into the sample anyway, the exact computeTTCCamera() is used and achievedRankError is 0.
+const float defaultTTCCameraRankError = 0.01f;
+size_t ttcCameraSampleSize(float rankError);
+float ttcCameraRankError(size_t sampleSize); // inverse of ttcCameraSampleSize()
+void computeTTCCameraSampled(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr,
+                             std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC,
+                             float rankError=defaultTTCCameraRankError, cv::Mat *visImg=nullptr, float *achievedRankError=nullptr);
+void computeTTCLidar(const PointCloudView &lidarPointsPrev,
+                     const PointCloudView &lidarPointsCurr, double frameRate, double &TTC);
+void computeTTCLidar(const LidarStats &lidarStatsPrev, const LidarStats &lidarStatsCurr, double frameRate, double &TTC);                  
 #endif /* camFusion_hpp */
@@ -6,81 +6,196 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "camFusion.hpp"
+#include "lidarData.hpp"
 #include "dataStructures.h"
 
 using namespace std;
 
-// helper function to get distance to lidar cloud with filtering out outlier points
-float getLidarPointCloudDistance(std::vector<LidarPoint> &lidarPoints)
+// count, extents and outlier-filtered distance of a Lidar cloud in a single pass over its points
+void computeLidarStats(const PointCloudView &lidarPoints, LidarStats &stats)
 {
-	std::vector<float> x_distances;
-	x_distances.reserve(lidarPoints.size());
-	float x_min = 1e8; // fallback value for too few lidar points
-	for (auto it1 = lidarPoints.begin(); it1 != lidarPoints.end(); ++it1)
+	stats = LidarStats();
+	stats.numPoints = (int)lidarPoints.size();
+	if (lidarPoints.empty()) return;
+
+	// the closest points are kept in a bounded max-heap, so no copy of all x values needs to be sorted
+	const int number_of_closest_points_to_consider = 9;
+	const int heap_capacity = number_of_closest_points_to_consider / 2 + 1; // median of the closest points is the largest of these
+	float closest[heap_capacity];
+	int heap_size = 0;
+
+	stats.xMin = stats.xMax = lidarPoints.x(0);
+	stats.yMin = stats.yMax = lidarPoints.y(0);
+	stats.zMin = stats.zMax = lidarPoints.z(0);
+	for (size_t i = 0; i < lidarPoints.size(); ++i)
 	{
-		float x = it1->x;
-		if (x_min > x) x_min = x;
-		x_distances.push_back(x);
+		float x = lidarPoints.x(i), y = lidarPoints.y(i), z = lidarPoints.z(i);
+		stats.xMin = min(stats.xMin, x); stats.xMax = max(stats.xMax, x);
+		stats.yMin = min(stats.yMin, y); stats.yMax = max(stats.yMax, y);
+		stats.zMin = min(stats.zMin, z); stats.zMax = max(stats.zMax, z);
+
+		if (heap_size < heap_capacity)
+		{
+			closest[heap_size++] = x;
+			std::push_heap(closest, closest + heap_size);
+		}
+		else if (x < closest[0])
+		{
+			std::pop_heap(closest, closest + heap_size);
+			closest[heap_size - 1] = x;
+			std::push_heap(closest, closest + heap_size);
+		}
 	}
-	std::sort(x_distances.begin(), x_distances.end());
-	int number_of_closest_points_to_consider = 9;
-	double x_min_median = x_min; // distance after filtering out outlier lidar points (test for lidar based TTC calculation)
-	if (x_distances.size() > number_of_closest_points_to_consider)
+
+	// distance after filtering out outlier lidar points, the closest point if there are too few of them
+	stats.xClosest = stats.numPoints > number_of_closest_points_to_consider ? closest[0] : stats.xMin;
+
+	// height of the (last) point at that distance
+	for (size_t i = 0; i < lidarPoints.size(); ++i)
 	{
-		// median of odd number of closest points
-		x_min_median = x_distances[number_of_closest_points_to_consider / 2];
+		if (lidarPoints.x(i) == stats.xClosest) stats.zClosest = lidarPoints.z(i);
 	}
-	return x_min_median;
 }
 
 // Create groups of Lidar points whose projection into the camera falls into the same bounding box
-void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT)
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, const PointCloud &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT)
 {
-    // loop over all Lidar points and associate them to a 2D bounding box
-    cv::Mat X(4, 1, cv::DataType<double>::type);
-    cv::Mat Y(3, 1, cv::DataType<double>::type);
+    // project all Lidar points at once and associate them to the bounding boxes
+    LidarCameraCalibration calibration(P_rect_xx, R_rect_xx, RT);
+    std::vector<cv::Point> lidarImgPoints;
+    calibration.projectToImage(lidarPoints, lidarImgPoints);
+    clusterLidarWithROI(boundingBoxes, lidarPoints, lidarImgPoints, shrinkFactor);
+}
 
-    for (auto it1 = lidarPoints.begin(); it1 != lidarPoints.end(); ++it1)
+// Uniform image-space grid over a set of boxes. Each cell lists the boxes overlapping it (stored in one flat
+// array), so a point only needs to be tested against the few candidate boxes of its cell.
+class BoxGrid
+{
+public:
+    BoxGrid(const vector<cv::Rect> &boxes, int cellSize) : cellSize(cellSize), nCellsX(0), nCellsY(0)
     {
-        // assemble vector for matrix-vector-multiplication
-        X.at<double>(0, 0) = it1->x;
-        X.at<double>(1, 0) = it1->y;
-        X.at<double>(2, 0) = it1->z;
-        X.at<double>(3, 0) = 1;
-
-        // project Lidar point into camera
-        Y = P_rect_xx * R_rect_xx * RT * X;
-        cv::Point pt;
-        // pixel coordinates
-        pt.x = Y.at<double>(0, 0) / Y.at<double>(2, 0); 
-        pt.y = Y.at<double>(1, 0) / Y.at<double>(2, 0); 
-
-        vector<vector<BoundingBox>::iterator> enclosingBoxes; // pointers to all bounding boxes which enclose the current Lidar point
-        for (vector<BoundingBox>::iterator it2 = boundingBoxes.begin(); it2 != boundingBoxes.end(); ++it2)
+        // grid covers the union of all non-empty boxes
+        bool bFirst = true;
+        for (auto it = boxes.begin(); it != boxes.end(); ++it)
         {
-            // shrink current bounding box slightly to avoid having too many outlier points around the edges
-            cv::Rect smallerBox;
-            smallerBox.x = (*it2).roi.x + shrinkFactor * (*it2).roi.width / 2.0;
-            smallerBox.y = (*it2).roi.y + shrinkFactor * (*it2).roi.height / 2.0;
-            smallerBox.width = (*it2).roi.width * (1 - shrinkFactor);
-            smallerBox.height = (*it2).roi.height * (1 - shrinkFactor);
-
-            // check wether point is within current bounding box
-            if (smallerBox.contains(pt))
+            if (it->width <= 0 || it->height <= 0) continue;
+            if (bFirst)
             {
-                enclosingBoxes.push_back(it2);
+                origin = it->tl();
+                extent = it->br();
+                bFirst = false;
             }
+            origin.x = min(origin.x, it->x);
+            origin.y = min(origin.y, it->y);
+            extent.x = max(extent.x, it->x + it->width);
+            extent.y = max(extent.y, it->y + it->height);
+        }
+        if (bFirst) return;
 
-        } // eof loop over all bounding boxes
+        nCellsX = (extent.x - origin.x + cellSize - 1) / cellSize;
+        nCellsY = (extent.y - origin.y + cellSize - 1) / cellSize;
 
-        // check wether point has been enclosed by one or by multiple boxes
-        if (enclosingBoxes.size() == 1)
-        { 
-            // add Lidar point to bounding box
-            enclosingBoxes[0]->lidarPoints.push_back(*it1);
+        // count boxes per cell, then fill the flat candidate array (counting sort)
+        cellStart.assign(nCellsX * nCellsY + 1, 0);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            vector<int> fill;
+            if (pass == 1)
+            {
+                for (size_t c = 1; c < cellStart.size(); ++c) cellStart[c] += cellStart[c - 1];
+                cellBoxes.resize(cellStart.back());
+                fill.assign(cellStart.begin(), cellStart.end() - 1);
+            }
+            for (size_t j = 0; j < boxes.size(); ++j)
+            {
+                const cv::Rect &box = boxes[j];
+                if (box.width <= 0 || box.height <= 0) continue;
+                int cx0 = (box.x - origin.x) / cellSize, cx1 = (box.x + box.width - 1 - origin.x) / cellSize;
+                int cy0 = (box.y - origin.y) / cellSize, cy1 = (box.y + box.height - 1 - origin.y) / cellSize;
+                for (int cy = cy0; cy <= cy1; ++cy)
+                    for (int cx = cx0; cx <= cx1; ++cx)
+                    {
+                        int cell = cy * nCellsX + cx;
+                        if (pass == 0) cellStart[cell + 1]++;
+                        else cellBoxes[fill[cell]++] = (int)j;
+                    }
+            }
+        }
+    }
+
+    // candidate boxes for pt as the range [first, last), empty if pt lies outside the grid
+    void candidates(const cv::Point &pt, const int *&first, const int *&last) const
+    {
+        first = last = nullptr;
+        if (pt.x < origin.x || pt.y < origin.y || pt.x >= extent.x || pt.y >= extent.y) return;
+        int cell = ((pt.y - origin.y) / cellSize) * nCellsX + (pt.x - origin.x) / cellSize;
+        first = cellBoxes.data() + cellStart[cell];
+        last = cellBoxes.data() + cellStart[cell + 1];
+    }
+
+private:
+    int cellSize;
+    int nCellsX, nCellsY;
+    cv::Point origin, extent; // grid bounds, extent is exclusive
+    vector<int> cellStart; // candidates of cell c are cellBoxes[cellStart[c]] ... cellBoxes[cellStart[c+1]-1]
+    vector<int> cellBoxes;
+};
+
+// associate Lidar points to 2D bounding boxes, using their precomputed image coordinates
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, const PointCloud &lidarPoints, std::vector<cv::Point> &lidarImgPoints, float shrinkFactor)
+{
+    // shrink bounding boxes slightly to avoid having too many outlier points around the edges
+    vector<cv::Rect> smallerBoxes;
+    smallerBoxes.reserve(boundingBoxes.size());
+    for (vector<BoundingBox>::iterator it2 = boundingBoxes.begin(); it2 != boundingBoxes.end(); ++it2)
+    {
+        cv::Rect smallerBox;
+        smallerBox.x = (*it2).roi.x + shrinkFactor * (*it2).roi.width / 2.0;
+        smallerBox.y = (*it2).roi.y + shrinkFactor * (*it2).roi.height / 2.0;
+        smallerBox.width = (*it2).roi.width * (1 - shrinkFactor);
+        smallerBox.height = (*it2).roi.height * (1 - shrinkFactor);
+        smallerBoxes.push_back(smallerBox);
+    }
+
+    // index the boxes once per frame, so that each point is only tested against the boxes of its grid cell
+    const int cellSize = 32; // [pixels]
+    BoxGrid grid(smallerBoxes, cellSize);
+
+    // loop over all Lidar points and associate them to a 2D bounding box
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        const cv::Point &pt = lidarImgPoints[i];
+        if (pt == LidarCameraCalibration::behindCamera)
+        {
+            continue;
+        }
+
+        // count the boxes which enclose the current Lidar point, remembering the first one
+        const int *first, *last;
+        grid.candidates(pt, first, last);
+        int nEnclosing = 0, enclosingBox = -1;
+        for (const int *it = first; it != last && nEnclosing < 2; ++it)
+        {
+            if (smallerBoxes[*it].contains(pt))
+            {
+                if (nEnclosing++ == 0) enclosingBox = *it;
+            }
+        }
+
+        // add Lidar point to bounding box only if it has been enclosed by exactly one box
+        if (nEnclosing == 1)
+        {
+            boundingBoxes[enclosingBox].lidarPoints.push_back(lidarPoints, i);
+            boundingBoxes[enclosingBox].lidarImgPoints.push_back(pt);
         }
 
     } // eof loop over all Lidar points
+
+    // summarize each box once, TTC computation and visualization (also on the next frame) read the cached values
+    for (auto &box : boundingBoxes)
+    {
+        computeLidarStats(box.lidarPoints, box.lidarStats);
+    }
 }
 
 /* 
@@ -97,21 +212,17 @@ void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize,
     {
         // create randomized color for current 3D object
         //cv::RNG rng(it1->boxID);
-		cv::RNG rng(it1->lidarPoints.empty()?0:it1->lidarPoints.front().x*0x2000000);
+		cv::RNG rng(it1->lidarPoints.empty()?0:(double)it1->lidarPoints.x.front()*0x2000000);
         cv::Scalar currColor = cv::Scalar(rng.uniform(0,150), rng.uniform(0, 150), rng.uniform(0, 150));
 
         // plot Lidar points into top view image
         int top=1e8, left=1e8, bottom=0.0, right=0.0; 
-        float xwmin=1e8, ywmin=1e8, ywmax=-1e8;
 
-        for (auto it2 = it1->lidarPoints.begin(); it2 != it1->lidarPoints.end(); ++it2)
+        for (size_t i = 0; i < it1->lidarPoints.size(); ++i)
         {
             // world coordinates
-            float xw = (*it2).x; // world position in m with x facing forward from sensor
-            float yw = (*it2).y; // world position in m with y facing left from sensor
-            xwmin = xwmin<xw ? xwmin : xw;
-            ywmin = ywmin<yw ? ywmin : yw;
-            ywmax = ywmax>yw ? ywmax : yw;
+            float xw = it1->lidarPoints.x[i]; // world position in m with x facing forward from sensor
+            float yw = it1->lidarPoints.y[i]; // world position in m with y facing left from sensor
 
             // top-view coordinates
             int y = (-(xw-6) * imageSize.height / worldSize.height) + imageSize.height;
@@ -127,18 +238,16 @@ void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize,
             cv::circle(topviewImg, cv::Point(x, y), 4, currColor, -1);
         }
 		
-		double xwmin_median = getLidarPointCloudDistance(it1->lidarPoints);
+        // distances and extents have been computed by clusterLidarWithROI()
+        const LidarStats &stats = it1->lidarStats;
 		
         // draw enclosing rectangle
         //cv::rectangle(topviewImg, cv::Point(left, top), cv::Point(right, bottom),cv::Scalar(0,0,0), 2);
-		// find height of median dist:
-		float z_of_closest_point = 0;
-		for (auto &p : it1->lidarPoints) if (p.x == xwmin_median) z_of_closest_point = p.z;
         // augment object with some key data
         char str1[200], str2[200];
-        sprintf(str1, "id=%d, #pts=%d", it1->boxID, (int)it1->lidarPoints.size());
+        sprintf(str1, "id=%d, #pts=%d", it1->boxID, stats.numPoints);
         putText(topviewImg, str1, cv::Point2f(left-250* imageSize.width /2000, bottom+50* imageSize.height / 2000), cv::FONT_ITALIC, imageSize.height/1000.0, currColor);
-        sprintf(str2, "xmin=%2.2f m (median %2.2f, z=%2.2f), yw=%2.2f m", xwmin, xwmin_median, z_of_closest_point, ywmax-ywmin);
+        sprintf(str2, "xmin=%2.2f m (median %2.2f, z=%2.2f), yw=%2.2f m", stats.xMin, stats.xClosest, stats.zClosest, stats.yMax - stats.yMin);
         putText(topviewImg, str2, cv::Point2f(left-250* imageSize.width / 2000, bottom+125 * imageSize.height / 2000), cv::FONT_ITALIC, imageSize.height / 1000.0, currColor);
 		
     }
@@ -171,6 +280,23 @@ void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize,
 }
 
 
+// keep those matches whose keypoint shift is not much larger than the mean shift within the box
+static void addConsistentKptMatches(BoundingBox &boundingBox, std::vector<cv::KeyPoint> &kptsCurr,
+                                    std::vector<std::pair<cv::DMatch, float> > &PreFilteredMatchesWithDistance, float distance_sum)
+{
+	float mean_distance = distance_sum / PreFilteredMatchesWithDistance.size();
+	float max_distance = mean_distance * 2 + 1; // with 1-1 pixel shift multiplication only is not reliable, I allowed +1 for pixel coordinate rounding error
+	for (auto &match_with_dist : PreFilteredMatchesWithDistance)
+	{
+		float dist = match_with_dist.second;
+		if (dist <= max_distance)
+		{
+			boundingBox.kptMatches.push_back(match_with_dist.first);
+			boundingBox.keypoints.push_back(kptsCurr[match_with_dist.first.trainIdx]); // not used anywhere
+		}
+	}
+}
+
 // associate a given bounding box with the keypoints it contains
 void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches)
 {
@@ -188,20 +314,50 @@ void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint
 			PreFilteredMatchesWithDistance.push_back(std::pair<cv::DMatch, float>(match, dist));
 		}
 	}
-	float mean_distance = distance_sum / PreFilteredMatchesWithDistance.size();
-	float max_distance = mean_distance * 2 + 1; // with 1-1 pixel shift multiplication only is not reliable, I allowed +1 for pixel coordinate rounding error
-	for (auto &match_with_dist : PreFilteredMatchesWithDistance)
+	addConsistentKptMatches(boundingBox, kptsCurr, PreFilteredMatchesWithDistance, distance_sum);
+}
+
+// same as above for currFrame.boundingBoxes[boxIdx], but only visits the matches which matchBoundingBoxes() has bucketed into the box
+void clusterKptMatchesWithROI(int boxIdx, DataFrame &prevFrame, DataFrame &currFrame)
+{
+	BoundingBox &boundingBox = currFrame.boundingBoxes[boxIdx];
+	if (currFrame.boxKptMatches.size() != currFrame.boundingBoxes.size())
 	{
-		float dist = match_with_dist.second;
-		if (dist <= max_distance)
-		{
-			boundingBox.kptMatches.push_back(match_with_dist.first);
-			boundingBox.keypoints.push_back(kptsCurr[match_with_dist.first.trainIdx]); // not used anywhere
-		}
+		// matches have not been bucketed for this frame
+		clusterKptMatchesWithROI(boundingBox, prevFrame.keypoints, currFrame.keypoints, currFrame.kptMatches);
+		return;
 	}
+
+	std::vector<std::pair<cv::DMatch, float> > PreFilteredMatchesWithDistance;
+	PreFilteredMatchesWithDistance.reserve(currFrame.boxKptMatches.end(boxIdx) - currFrame.boxKptMatches.begin(boxIdx));
+	float distance_sum = 0;
+	for (const int *it = currFrame.boxKptMatches.begin(boxIdx); it != currFrame.boxKptMatches.end(boxIdx); ++it)
+	{
+		cv::DMatch &match = currFrame.kptMatches[*it];
+		auto dist_vect = currFrame.keypoints[match.trainIdx].pt - prevFrame.keypoints[match.queryIdx].pt;
+		float dist = sqrt(dist_vect.x*dist_vect.x + dist_vect.y*dist_vect.y);
+		distance_sum += dist;
+		PreFilteredMatchesWithDistance.push_back(std::pair<cv::DMatch, float>(match, dist));
+	}
+	addConsistentKptMatches(boundingBox, currFrame.keypoints, PreFilteredMatchesWithDistance, distance_sum);
 }
 
 
+// median of values, reordering them (the mean of both middle values for an even count)
+static float medianOf(std::vector<float> &values)
+{
+	// nth_element is more optimal than sort, we only need the middle value (or values if length is even)
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	float median = values[values.size() / 2];
+	if (values.size() % 2 == 0)
+	{
+		int idx = values.size() / 2 - 1;
+		std::nth_element(values.begin(), values.begin() + idx, values.end());
+		median = (median + values[idx]) / 2;
+	}
+	return median;
+}
+
 // Compute time-to-collision (TTC) based on keypoint correspondences in successive images
 void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, 
                       std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC, cv::Mat *visImg)
@@ -213,10 +369,6 @@ void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPo
 	{
 		auto kp1_prev = kptsPrev[match_it1->queryIdx].pt;
 		auto kp1_curr = kptsCurr[match_it1->trainIdx].pt;
-		if (visImg != nullptr)
-		{
-			cv::line(*visImg, kp1_prev, kp1_curr, cv::Scalar(255, 255, 0), 1);
-		}
 		for (auto match_it2 = match_it1 + 1; match_it2 != kptMatches.end(); ++match_it2)
 		{
 			auto kp2_prev = kptsPrev[match_it2->queryIdx].pt;
@@ -229,6 +381,12 @@ void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPo
 			if (dist_curr > max_point_dist) max_point_dist = dist_curr;
 		}
 	}
+	// matches are drawn in a separate pass, keeping the pair loop free of drawing calls
+	if (visImg != nullptr)
+	{
+		for (auto &match : kptMatches) cv::line(*visImg, kptsPrev[match.queryIdx].pt, kptsCurr[match.trainIdx].pt, cv::Scalar(255, 255, 0), 1);
+	}
+
 	std::vector<float> filtered_distance_ratios;
 	for (auto dist_pair : distance_pairs)
 	{
@@ -237,30 +395,116 @@ void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPo
 			filtered_distance_ratios.push_back(dist_pair.second / dist_pair.first);
 		}
 	}
-	// nth_element is more optimal than sort, we only need the middle value (or values if length is even)
-	std::nth_element(filtered_distance_ratios.begin(),
-		filtered_distance_ratios.begin() + filtered_distance_ratios.size() / 2,
-		filtered_distance_ratios.end());
-	float median_dist_ratio = filtered_distance_ratios[filtered_distance_ratios.size() / 2];
-	if (filtered_distance_ratios.size() % 2 == 0)
-	{
-		int idx = filtered_distance_ratios.size() / 2 - 1;
-		std::nth_element(filtered_distance_ratios.begin(),
-			filtered_distance_ratios.begin() + idx,
-			filtered_distance_ratios.end());
-		median_dist_ratio = (median_dist_ratio + filtered_distance_ratios[idx]) / 2;
-	}
 	// using median instead of mean, big errors have less effect in the result
+	float median_dist_ratio = medianOf(filtered_distance_ratios);
 	
 	TTC = 1 / (frameRate * (median_dist_ratio - 1)); // frameRate is 1/s
 }
 
 
-void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
-                     std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC)
+// The sample size follows from the DKW inequality, so that the sampled median lies within rankError (as a fraction
+// of all accepted pairs) of the exact one with 99% probability.
+static const double ttcCameraDelta = 0.01; // allowed probability of exceeding the rank error
+
+size_t ttcCameraSampleSize(float rankError)
+{
+	return (size_t)ceil(log(2 / ttcCameraDelta) / (2.0 * rankError * rankError));
+}
+
+float ttcCameraRankError(size_t sampleSize)
+{
+	return sampleSize == 0 ? 1.0f : (float)sqrt(log(2 / ttcCameraDelta) / (2.0 * sampleSize));
+}
+
+
+// Same estimate as computeTTCCamera() with a memory footprint independent of the no. of point pairs. The max. pair
+// distance is found on the convex hull of the current keypoints and the median distance ratio is taken over a fixed
+// pseudo-random sample of pairs.
+void computeTTCCameraSampled(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr,
+                             std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC, float rankError, cv::Mat *visImg,
+                             float *achievedRankError)
+{
+	size_t sampleSize = ttcCameraSampleSize(rankError);
+	size_t n = kptMatches.size();
+	if (n < 2 || n * (n - 1) / 2 <= sampleSize)
+	{
+		// all pairs fit into the sample budget anyway
+		computeTTCCamera(kptsPrev, kptsCurr, kptMatches, frameRate, TTC, visImg);
+		if (achievedRankError != nullptr) *achievedRankError = 0;
+		return;
+	}
+
+	std::vector<cv::Point2f> pts_prev(n), pts_curr(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		pts_prev[i] = kptsPrev[kptMatches[i].queryIdx].pt;
+		pts_curr[i] = kptsCurr[kptMatches[i].trainIdx].pt;
+	}
+
+	// the two points furthest apart are vertices of the convex hull
+	std::vector<cv::Point2f> hull;
+	cv::convexHull(pts_curr, hull);
+	float max_point_dist = 0;
+	for (size_t i = 0; i < hull.size(); ++i)
+	{
+		for (size_t j = i + 1; j < hull.size(); ++j)
+		{
+			auto curr_vect = hull[j] - hull[i];
+			float dist_curr = sqrt(curr_vect.dot(curr_vect));
+			if (dist_curr > max_point_dist) max_point_dist = dist_curr;
+		}
+	}
+
+	// draw pairs uniformly (with a fixed seed, so results are reproducible) until enough of them pass the filter
+	std::vector<float> filtered_distance_ratios;
+	filtered_distance_ratios.reserve(sampleSize);
+	cv::RNG rng(0x2545F491);
+	const size_t maxDraws = 20 * sampleSize; // bounds the runtime when only few pairs are far enough apart
+	for (size_t draw = 0; draw < maxDraws && filtered_distance_ratios.size() < sampleSize; ++draw)
+	{
+		int i = rng.uniform(0, (int)n);
+		int j = rng.uniform(0, (int)n - 1);
+		if (j >= i) ++j;
+		auto prev_vect = pts_prev[j] - pts_prev[i];
+		float dist_prev = sqrt(prev_vect.dot(prev_vect));
+		auto curr_vect = pts_curr[j] - pts_curr[i];
+		float dist_curr = sqrt(curr_vect.dot(curr_vect));
+		if (dist_prev > 0 && dist_curr > max_point_dist / 2)
+		{
+			filtered_distance_ratios.push_back(dist_curr / dist_prev);
+		}
+	}
+	// the cap keeps runtime and memory bounded when only few pairs are far enough apart, at the cost of a larger rank error
+	if (achievedRankError != nullptr) *achievedRankError = ttcCameraRankError(filtered_distance_ratios.size());
+	if (filtered_distance_ratios.empty())
+	{
+		TTC = NAN;
+		return;
+	}
+	if (visImg != nullptr)
+	{
+		for (size_t i = 0; i < n; ++i) cv::line(*visImg, pts_prev[i], pts_curr[i], cv::Scalar(255, 255, 0), 1);
+	}
+
+	float median_dist_ratio = medianOf(filtered_distance_ratios);
+	TTC = 1 / (frameRate * (median_dist_ratio - 1)); // frameRate is 1/s
+}
+
+
+void computeTTCLidar(const PointCloudView &lidarPointsPrev,
+                     const PointCloudView &lidarPointsCurr, double frameRate, double &TTC)
+{
+	LidarStats lidarStatsPrev, lidarStatsCurr;
+	computeLidarStats(lidarPointsPrev, lidarStatsPrev);
+	computeLidarStats(lidarPointsCurr, lidarStatsCurr);
+	computeTTCLidar(lidarStatsPrev, lidarStatsCurr, frameRate, TTC);
+}
+
+// same as above, based on the statistics cached by clusterLidarWithROI()
+void computeTTCLidar(const LidarStats &lidarStatsPrev, const LidarStats &lidarStatsCurr, double frameRate, double &TTC)
 {
-	float x_min_prev = getLidarPointCloudDistance(lidarPointsPrev);
-	float x_min_curr = getLidarPointCloudDistance(lidarPointsCurr);
+	float x_min_prev = lidarStatsPrev.xClosest;
+	float x_min_curr = lidarStatsCurr.xClosest;
 	if (x_min_curr >= x_min_prev) TTC = 1000;
 	else
 	{
@@ -271,45 +515,82 @@ void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
 }
 
 
+// find the bounding boxes enclosing each keypoint of the frame, in a single pass over the keypoints
+void mapKeypointsToBoxes(DataFrame &frame)
+{
+	vector<cv::Rect> rois;
+	rois.reserve(frame.boundingBoxes.size());
+	for (auto &box : frame.boundingBoxes) rois.push_back(box.roi);
+	BoxGrid grid(rois, 32);
+
+	IndexBuckets &kptBoxes = frame.kptBoxes;
+	kptBoxes.first.assign(1, 0);
+	kptBoxes.first.reserve(frame.keypoints.size() + 1);
+	kptBoxes.indices.clear();
+	for (auto &kpt : frame.keypoints)
+	{
+		cv::Point pt = kpt.pt; // rounded to pixels, as by roi.contains(kpt.pt)
+		const int *first, *last;
+		grid.candidates(pt, first, last);
+		for (const int *it = first; it != last; ++it)
+		{
+			if (rois[*it].contains(pt)) kptBoxes.indices.push_back(*it);
+		}
+		kptBoxes.first.push_back((int)kptBoxes.indices.size());
+	}
+}
+
 void matchBoundingBoxes(std::vector<cv::DMatch> &matches, std::map<int, int> &bbBestMatches, DataFrame &prevFrame, DataFrame &currFrame)
 {
-	std::map<int, std::map<int, int> > bounding_box_matches;
-	// bounding_box_matches maps prev frame bounding box id to all possible candidates
-	// in current frame: a map from candidate box id to number of keypoint matches
+	// keypoint-to-box mappings are computed once per frame
+	if (prevFrame.kptBoxes.size() != prevFrame.keypoints.size()) mapKeypointsToBoxes(prevFrame);
+	if (currFrame.kptBoxes.size() != currFrame.keypoints.size()) mapKeypointsToBoxes(currFrame);
+
+	// counts[prev * nCurr + curr] is the number of keypoint matches shared by a pair of boxes (indices into boundingBoxes)
+	size_t nPrev = prevFrame.boundingBoxes.size(), nCurr = currFrame.boundingBoxes.size();
+	std::vector<int> counts(nPrev * nCurr, 0);
+
+	// also bucket the matches by the current boxes enclosing them, for clusterKptMatchesWithROI()
+	IndexBuckets &boxKptMatches = currFrame.boxKptMatches;
+	boxKptMatches.first.assign(nCurr + 1, 0);
 	for (auto &match : matches)
 	{
-		cv::KeyPoint &prevKeyPoint = prevFrame.keypoints[match.queryIdx];
-		cv::KeyPoint &currKeyPoint = currFrame.keypoints[match.trainIdx];
-		for (auto &prevBox : prevFrame.boundingBoxes)
+		const int *currFirst = currFrame.kptBoxes.begin(match.trainIdx), *currLast = currFrame.kptBoxes.end(match.trainIdx);
+		for (const int *c = currFirst; c != currLast; ++c) boxKptMatches.first[*c + 1]++;
+		for (const int *p = prevFrame.kptBoxes.begin(match.queryIdx); p != prevFrame.kptBoxes.end(match.queryIdx); ++p)
 		{
-			if (prevBox.roi.contains(prevKeyPoint.pt))
-			{
-				for (auto &currBox : currFrame.boundingBoxes)
-				{
-					if (currBox.roi.contains(currKeyPoint.pt))
-					{
-						bounding_box_matches[prevBox.boxID][currBox.boxID]++;
-					}
-				}
-			}
+			for (const int *c = currFirst; c != currLast; ++c) counts[*p * nCurr + *c]++;
 		}
 	}
-	// search for max match count for each box in prevFrame:
-	for (auto &p : bounding_box_matches)
+	for (size_t c = 0; c < nCurr; ++c) boxKptMatches.first[c + 1] += boxKptMatches.first[c];
+	boxKptMatches.indices.resize(boxKptMatches.first.back());
+	std::vector<int> fill(boxKptMatches.first.begin(), boxKptMatches.first.end() - 1);
+	for (size_t m = 0; m < matches.size(); ++m)
+	{
+		for (const int *c = currFrame.kptBoxes.begin(matches[m].trainIdx); c != currFrame.kptBoxes.end(matches[m].trainIdx); ++c)
+		{
+			boxKptMatches.indices[fill[*c]++] = (int)m;
+		}
+	}
+
+	// search for max match count for each box in prevFrame, ties go to the lower box ID
+	for (size_t p = 0; p < nPrev; ++p)
 	{
 		int max_match = 0;
 		int max_match_id = -1;
-		for (auto p2 : p.second)
+		for (size_t c = 0; c < nCurr; ++c)
 		{
-			if (p2.second > max_match)
+			int n = counts[p * nCurr + c];
+			int id = currFrame.boundingBoxes[c].boxID;
+			if (n > max_match || (n > 0 && n == max_match && id < max_match_id))
 			{
-				max_match = p2.second;
-				max_match_id = p2.first;
+				max_match = n;
+				max_match_id = id;
 			}
 		}
 		if (max_match_id != -1)
 		{
-			bbBestMatches[p.first] = max_match_id;
+			bbBestMatches[prevFrame.boundingBoxes[p].boxID] = max_match_id;
 		}
 	}
 }
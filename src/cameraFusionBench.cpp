@@ -0,0 +1,589 @@
+
+/* MICROBENCHMARKS FOR THE CAMERA / LIDAR FUSION KERNELS */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "dataStructures.h"
+#include "lidarData.hpp"
+#include "camFusion.hpp"
+#include "matching2D.hpp"
+#include "featurePipeline.hpp"
+#include "hammingMatcher.hpp"
+
+using namespace std;
+
+namespace
+{
+
+const double minTimePerSize = 0.2; // [s] of timed kernel calls per measurement
+const cv::Size imgSize(1242, 375); // KITTI camera image
+const string kittiPrefix = "../images/KITTI/2011_09_26/";
+const string tmpLidarFile = "camera_fusion_bench_lidar.bin";
+
+// ego lane, as cropped by run()
+const float minX = 2.0, maxX = 20.0, maxY = 2.0, minZ = -1.5, maxZ = -0.9, minR = 0.1;
+const float shrinkFactor = 0.10;
+
+// Mean time per call of kernel() in [ns], repeated until minTimePerSize has been spent in the kernel. reset() restores
+// the input of the kernel before each call and is not timed. cout is silenced meanwhile, since some kernels log per call.
+template <typename Reset, typename Kernel>
+double nsPerCall(Reset reset, Kernel kernel)
+{
+    int64_t ticks = 0, minTicks = (int64_t)(minTimePerSize * cv::getTickFrequency());
+    int64_t deadline = (int64_t)cv::getTickCount() + 10 * minTicks; // bounds the time spent in reset()
+    int nCalls = 0;
+    cout.setstate(ios::failbit);
+    while (nCalls < 3 || (ticks < minTicks && (int64_t)cv::getTickCount() < deadline))
+    {
+        reset();
+        int64_t t = cv::getTickCount();
+        kernel();
+        ticks += cv::getTickCount() - t;
+        ++nCalls;
+    }
+    cout.clear();
+    return ticks / cv::getTickFrequency() * 1e9 / nCalls;
+}
+
+// Time per call and per element of one kernel over increasing input sizes. The scaling exponent between successive
+// sizes, log(t2 / t1) / log(n2 / n1), is 1 for a linear kernel and 2 for a quadratic one; exponents above 1.2 are
+// marked with '*' to show where a kernel becomes superlinear.
+class ScalingCurve
+{
+public:
+    ScalingCurve(const string &kernel, const string &input, const string &element) : label(kernel + " | " + input + " | " + element) {}
+
+    void add(size_t n, double ns)
+    {
+        sizes.push_back(n);
+        times.push_back(ns);
+    }
+
+    void print() const
+    {
+        ios::fmtflags flags = cout.flags();
+        streamsize precision = cout.precision();
+        cout << fixed;
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            cout << label << " | " << sizes[i] << " | " << setprecision(0) << times[i] << " | " << setprecision(2) << times[i] / max<size_t>(sizes[i], 1) << " | ";
+            if (i > 0 && sizes[i] != sizes[i - 1] && times[i - 1] > 0)
+            {
+                double exponent = log(times[i] / times[i - 1]) / log((double)sizes[i] / sizes[i - 1]);
+                cout << exponent << (exponent > 1.2 ? " *" : "");
+            }
+            else
+            {
+                cout << "-";
+            }
+            cout << endl;
+        }
+        cout.flags(flags);
+        cout.precision(precision);
+    }
+
+private:
+    string label;
+    vector<size_t> sizes;
+    vector<double> times; // [ns] per call
+};
+
+// n, 2n, 4n, ... up to max
+vector<size_t> doublings(size_t first, size_t max)
+{
+    vector<size_t> sizes;
+    for (size_t n = first; n <= max; n *= 2) sizes.push_back(n);
+    return sizes;
+}
+
+// inputs: the bundled KITTI frames 0 and 1, if present
+struct KittiFrames
+{
+    bool bLidar = false, bCamera = false;
+
+    PointCloud scan; // full scan of frame 0
+    vector<cv::Point> scanImgPoints; // its image coordinates
+    PointCloud egoLanePrev, egoLaneCurr; // points of frames 0 and 1 within the ego lane
+
+    cv::Mat imgGray; // frame 0
+    vector<cv::KeyPoint> kptsPrev, kptsCurr; // FAST keypoints of frames 0 and 1
+    cv::Mat descPrev, descCurr; // their BRIEF descriptors
+    vector<cv::DMatch> matches; // frame 0 -> frame 1
+};
+
+LidarCameraCalibration kittiCalibration()
+{
+    cv::Mat P_rect_00(3,4,cv::DataType<double>::type);
+    cv::Mat R_rect_00(4,4,cv::DataType<double>::type);
+    cv::Mat RT(4,4,cv::DataType<double>::type);
+
+    RT.at<double>(0,0) = 7.533745e-03; RT.at<double>(0,1) = -9.999714e-01; RT.at<double>(0,2) = -6.166020e-04; RT.at<double>(0,3) = -4.069766e-03;
+    RT.at<double>(1,0) = 1.480249e-02; RT.at<double>(1,1) = 7.280733e-04; RT.at<double>(1,2) = -9.998902e-01; RT.at<double>(1,3) = -7.631618e-02;
+    RT.at<double>(2,0) = 9.998621e-01; RT.at<double>(2,1) = 7.523790e-03; RT.at<double>(2,2) = 1.480755e-02; RT.at<double>(2,3) = -2.717806e-01;
+    RT.at<double>(3,0) = 0.0; RT.at<double>(3,1) = 0.0; RT.at<double>(3,2) = 0.0; RT.at<double>(3,3) = 1.0;
+
+    R_rect_00.at<double>(0,0) = 9.999239e-01; R_rect_00.at<double>(0,1) = 9.837760e-03; R_rect_00.at<double>(0,2) = -7.445048e-03; R_rect_00.at<double>(0,3) = 0.0;
+    R_rect_00.at<double>(1,0) = -9.869795e-03; R_rect_00.at<double>(1,1) = 9.999421e-01; R_rect_00.at<double>(1,2) = -4.278459e-03; R_rect_00.at<double>(1,3) = 0.0;
+    R_rect_00.at<double>(2,0) = 7.402527e-03; R_rect_00.at<double>(2,1) = 4.351614e-03; R_rect_00.at<double>(2,2) = 9.999631e-01; R_rect_00.at<double>(2,3) = 0.0;
+    R_rect_00.at<double>(3,0) = 0; R_rect_00.at<double>(3,1) = 0; R_rect_00.at<double>(3,2) = 0; R_rect_00.at<double>(3,3) = 1;
+
+    P_rect_00.at<double>(0,0) = 7.215377e+02; P_rect_00.at<double>(0,1) = 0.000000e+00; P_rect_00.at<double>(0,2) = 6.095593e+02; P_rect_00.at<double>(0,3) = 0.000000e+00;
+    P_rect_00.at<double>(1,0) = 0.000000e+00; P_rect_00.at<double>(1,1) = 7.215377e+02; P_rect_00.at<double>(1,2) = 1.728540e+02; P_rect_00.at<double>(1,3) = 0.000000e+00;
+    P_rect_00.at<double>(2,0) = 0.000000e+00; P_rect_00.at<double>(2,1) = 0.000000e+00; P_rect_00.at<double>(2,2) = 1.000000e+00; P_rect_00.at<double>(2,3) = 0.000000e+00;
+
+    return LidarCameraCalibration(P_rect_00, R_rect_00, RT);
+}
+
+KittiFrames loadKitti()
+{
+    KittiFrames kitti;
+    string lidarPrefix = kittiPrefix + "velodyne_points/data/000000000", imgPrefix = kittiPrefix + "image_02/data/000000000";
+
+    if (ifstream(lidarPrefix + "0.bin") && ifstream(lidarPrefix + "1.bin"))
+    {
+        kitti.bLidar = loadLidarFromFile(kitti.scan, lidarPrefix + "0.bin") && !kitti.scan.empty() &&
+                       loadLidarFromFile(kitti.egoLanePrev, lidarPrefix + "0.bin", minX, maxX, maxY, minZ, maxZ, minR) &&
+                       loadLidarFromFile(kitti.egoLaneCurr, lidarPrefix + "1.bin", minX, maxX, maxY, minZ, maxZ, minR);
+        if (kitti.bLidar) kittiCalibration().projectToImage(kitti.scan, kitti.scanImgPoints);
+    }
+
+    cv::Mat imgPrev = cv::imread(imgPrefix + "0.png"), imgCurr = cv::imread(imgPrefix + "1.png");
+    if (!imgPrev.empty() && !imgCurr.empty())
+    {
+        cv::Mat imgGrayCurr;
+        cv::cvtColor(imgPrev, kitti.imgGray, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(imgCurr, imgGrayCurr, cv::COLOR_BGR2GRAY);
+
+        FeaturePipeline features("FAST", "BRIEF");
+        features.detect(kitti.imgGray, kitti.kptsPrev);
+        features.describe(kitti.kptsPrev, kitti.imgGray, kitti.descPrev);
+        features.detect(imgGrayCurr, kitti.kptsCurr);
+        features.describe(kitti.kptsCurr, imgGrayCurr, kitti.descCurr);
+        matchHammingKnnRatio(kitti.descPrev, kitti.descCurr, kitti.matches);
+        kitti.bCamera = !kitti.matches.empty();
+    }
+    return kitti;
+}
+
+// synthetic inputs, generated from a fixed seed
+
+// points spread like a Velodyne scan around the vehicle: x forward, y left, z up [m]
+PointCloud syntheticCloud(size_t n, cv::RNG &rng)
+{
+    PointCloud cloud;
+    cloud.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        cloud.push_back((float)rng.uniform(-40.0, 40.0), (float)rng.uniform(-20.0, 20.0), (float)rng.uniform(-2.0, 1.0), (float)rng.uniform(0.0, 1.0));
+    return cloud;
+}
+
+// points on the rear of a vehicle at distance x [m]
+PointCloud syntheticVehicleCloud(size_t n, float x, cv::RNG &rng)
+{
+    PointCloud cloud;
+    cloud.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        cloud.push_back(x + (float)rng.uniform(0.0, 0.3), (float)rng.uniform(-0.8, 0.8), (float)rng.uniform(-1.5, -0.9), (float)rng.uniform(0.1, 1.0));
+    return cloud;
+}
+
+vector<cv::Point> syntheticImgPoints(size_t n, cv::RNG &rng)
+{
+    vector<cv::Point> imgPoints(n);
+    for (auto &pt : imgPoints) pt = cv::Point(rng.uniform(0, imgSize.width), rng.uniform(0, imgSize.height));
+    return imgPoints;
+}
+
+vector<BoundingBox> syntheticBoxes(size_t n, cv::RNG &rng)
+{
+    vector<BoundingBox> boxes(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        int width = rng.uniform(40, 300), height = rng.uniform(30, 200);
+        boxes[i].boxID = boxes[i].trackID = (int)i;
+        boxes[i].roi = cv::Rect(rng.uniform(0, imgSize.width - width), rng.uniform(0, imgSize.height - height), width, height);
+        boxes[i].classID = 2;
+        boxes[i].confidence = 1.0;
+    }
+    return boxes;
+}
+
+// n keypoint matches within region, the current keypoints expanded by scale about its center (an approaching object)
+// and stored in shuffled order
+void syntheticKeypointMatches(size_t n, cv::Rect region, float scale, cv::RNG &rng,
+                              vector<cv::KeyPoint> &kptsPrev, vector<cv::KeyPoint> &kptsCurr, vector<cv::DMatch> &matches)
+{
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    for (size_t i = n; i > 1; --i) swap(order[i - 1], order[rng.uniform(0, (int)i)]);
+
+    cv::Point2f center(region.x + region.width / 2.0f, region.y + region.height / 2.0f);
+    kptsPrev.assign(n, cv::KeyPoint());
+    kptsCurr.assign(n, cv::KeyPoint());
+    matches.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        kptsPrev[i].pt = cv::Point2f((float)rng.uniform((double)region.x, (double)region.br().x), (float)rng.uniform((double)region.y, (double)region.br().y));
+        cv::Point2f noise((float)rng.uniform(-0.3, 0.3), (float)rng.uniform(-0.3, 0.3));
+        kptsCurr[order[i]].pt = center + (kptsPrev[i].pt - center) * scale + noise;
+        matches.push_back(cv::DMatch((int)i, order[i], 0));
+    }
+}
+
+// random 32 byte (BRIEF, ORB) descriptors, descRef row i is descSource row i with about 10% of the bits flipped
+void syntheticDescriptors(size_t n, cv::RNG &rng, cv::Mat &descSource, cv::Mat &descRef)
+{
+    const int bytes = 32;
+    descSource.create((int)n, bytes, CV_8U);
+    for (int i = 0; i < descSource.rows; ++i)
+        for (int j = 0; j < bytes; ++j) descSource.at<uchar>(i, j) = (uchar)rng.uniform(0, 256);
+    descRef = descSource.clone();
+    for (int i = 0; i < descRef.rows; ++i)
+        for (int k = 0; k < bytes * 8 / 10; ++k) descRef.at<uchar>(i, rng.uniform(0, bytes)) ^= (uchar)(1 << rng.uniform(0, 8));
+}
+
+// first n points of cloud
+PointCloud prefix(const PointCloud &cloud, size_t n)
+{
+    vector<int> indices(min(n, cloud.size()));
+    iota(indices.begin(), indices.end(), 0);
+    PointCloud result;
+    result.assign(cloud, indices);
+    return result;
+}
+
+// KITTI velodyne file format: x, y, z and r as float32 per point
+void writeLidarFile(const string &filename, const PointCloud &cloud)
+{
+    ofstream file(filename, ios::binary);
+    for (size_t i = 0; i < cloud.size(); ++i)
+    {
+        float point[4] = { cloud.x[i], cloud.y[i], cloud.z[i], cloud.r[i] };
+        file.write((const char *)point, sizeof(point));
+    }
+}
+
+// benchmarks, each on synthetic inputs and (if present) on KITTI inputs
+
+void benchLoadLidarFromFile(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    vector<pair<string, PointCloud>> inputs = { { "synthetic", syntheticCloud(262144, rng) } };
+    if (kitti.bLidar) inputs.push_back({ "KITTI", kitti.scan });
+
+    for (auto &input : inputs)
+    {
+        ScalingCurve full("loadLidarFromFile", input.first, "point"), cropped("loadLidarFromFile (ego lane)", input.first, "point");
+        PointCloud cloud;
+        for (size_t n : doublings(8192, input.second.size()))
+        {
+            writeLidarFile(tmpLidarFile, prefix(input.second, n));
+            full.add(n, nsPerCall([&] { cloud.clear(); }, [&] { loadLidarFromFile(cloud, tmpLidarFile); }));
+            cropped.add(n, nsPerCall([] {}, [&] { loadLidarFromFile(cloud, tmpLidarFile, minX, maxX, maxY, minZ, maxZ, minR); }));
+        }
+        full.print();
+        cropped.print();
+    }
+    remove(tmpLidarFile.c_str());
+}
+
+void benchCropLidarPoints(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    vector<pair<string, PointCloud>> inputs = { { "synthetic", syntheticCloud(262144, rng) } };
+    if (kitti.bLidar) inputs.push_back({ "KITTI", kitti.scan });
+
+    for (auto &input : inputs)
+    {
+        ScalingCurve curve("cropLidarPoints", input.first, "point");
+        PointCloud cloud;
+        for (size_t n : doublings(8192, input.second.size()))
+        {
+            PointCloud points = prefix(input.second, n);
+            curve.add(n, nsPerCall([&] { cloud = points; }, [&] { cropLidarPoints(cloud, minX, maxX, maxY, minZ, maxZ, minR); }));
+        }
+        curve.print();
+    }
+}
+
+void benchClusterLidarWithROI(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    struct Input { string name; PointCloud cloud; vector<cv::Point> imgPoints; };
+    vector<Input> inputs = { { "synthetic", syntheticCloud(262144, rng), syntheticImgPoints(262144, rng) } };
+    if (kitti.bLidar) inputs.push_back({ "KITTI", kitti.scan, kitti.scanImgPoints });
+
+    auto time = [](vector<BoundingBox> &boxes, const PointCloud &cloud, vector<cv::Point> &imgPoints)
+    {
+        return nsPerCall([&] { for (auto &box : boxes) { box.lidarPoints.clear(); box.lidarImgPoints.clear(); } },
+                         [&] { clusterLidarWithROI(boxes, cloud, imgPoints, shrinkFactor); });
+    };
+
+    for (auto &input : inputs)
+    {
+        // points into 8 boxes
+        ScalingCurve byPoints("clusterLidarWithROI", input.name + ", 8 boxes", "point");
+        vector<BoundingBox> boxes = syntheticBoxes(8, rng);
+        for (size_t n : doublings(8192, input.cloud.size()))
+        {
+            PointCloud cloud = prefix(input.cloud, n);
+            vector<cv::Point> imgPoints(input.imgPoints.begin(), input.imgPoints.begin() + n);
+            byPoints.add(n, time(boxes, cloud, imgPoints));
+        }
+        byPoints.print();
+
+        // all points into a growing no. of boxes
+        ScalingCurve byBoxes("clusterLidarWithROI", input.name + ", " + to_string(input.cloud.size()) + " points", "box");
+        for (size_t n : doublings(1, 64))
+        {
+            boxes = syntheticBoxes(n, rng);
+            byBoxes.add(n, time(boxes, input.cloud, input.imgPoints));
+        }
+        byBoxes.print();
+    }
+}
+
+// keypoints, matches and boxes of two frames
+struct FramePair
+{
+    string name;
+    DataFrame prev, curr;
+    vector<cv::DMatch> matches;
+};
+
+vector<FramePair> framePairs(const KittiFrames &kitti, size_t nSyntheticMatches, cv::RNG &rng)
+{
+    vector<FramePair> pairs(1);
+    pairs[0].name = "synthetic";
+    syntheticKeypointMatches(nSyntheticMatches, cv::Rect(cv::Point(0, 0), imgSize), 1.02f, rng, pairs[0].prev.keypoints,
+                             pairs[0].curr.keypoints, pairs[0].matches);
+    if (kitti.bCamera)
+    {
+        pairs.push_back(FramePair());
+        pairs[1].name = "KITTI";
+        pairs[1].prev.keypoints = kitti.kptsPrev;
+        pairs[1].curr.keypoints = kitti.kptsCurr;
+        pairs[1].matches = kitti.matches;
+    }
+    return pairs;
+}
+
+void benchMatchBoundingBoxes(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    map<int, int> bbBestMatches;
+    auto time = [&](DataFrame &prev, DataFrame &curr, vector<cv::DMatch> &matches)
+    {
+        // the keypoint-to-box mappings are cached per frame, clearing them times the full work of a new frame pair
+        return nsPerCall([&] { prev.kptBoxes.first.clear(); curr.kptBoxes.first.clear(); bbBestMatches.clear(); },
+                         [&] { matchBoundingBoxes(matches, bbBestMatches, prev, curr); });
+    };
+
+    for (auto &input : framePairs(kitti, 16000, rng))
+    {
+        ScalingCurve byMatches("matchBoundingBoxes", input.name + ", 8 boxes", "match");
+        input.prev.boundingBoxes = input.curr.boundingBoxes = syntheticBoxes(8, rng);
+        for (size_t n : doublings(250, input.matches.size()))
+        {
+            vector<cv::DMatch> matches(input.matches.begin(), input.matches.begin() + n);
+            byMatches.add(n, time(input.prev, input.curr, matches));
+        }
+        byMatches.print();
+
+        ScalingCurve byBoxes("matchBoundingBoxes", input.name + ", " + to_string(input.matches.size()) + " matches", "box");
+        for (size_t n : doublings(1, 64))
+        {
+            input.prev.boundingBoxes = input.curr.boundingBoxes = syntheticBoxes(n, rng);
+            byBoxes.add(n, time(input.prev, input.curr, input.matches));
+        }
+        byBoxes.print();
+    }
+}
+
+void benchClusterKptMatchesWithROI(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    for (auto &input : framePairs(kitti, 16000, rng))
+    {
+        // all matches against one box, as without bucketing by matchBoundingBoxes()
+        ScalingCurve byMatches("clusterKptMatchesWithROI", input.name + ", 1 box", "match");
+        BoundingBox box = syntheticBoxes(1, rng)[0];
+        box.roi = cv::Rect(400, 100, 400, 200);
+        for (size_t n : doublings(250, input.matches.size()))
+        {
+            vector<cv::DMatch> matches(input.matches.begin(), input.matches.begin() + n);
+            byMatches.add(n, nsPerCall([&] { box.kptMatches.clear(); box.keypoints.clear(); },
+                                       [&] { clusterKptMatchesWithROI(box, input.prev.keypoints, input.curr.keypoints, matches); }));
+        }
+        byMatches.print();
+
+        // all boxes of a frame, each visiting the matches bucketed into it
+        ScalingCurve byBoxes("clusterKptMatchesWithROI (bucketed)", input.name + ", " + to_string(input.matches.size()) + " matches", "box");
+        for (size_t n : doublings(1, 64))
+        {
+            input.prev.boundingBoxes = input.curr.boundingBoxes = syntheticBoxes(n, rng);
+            input.prev.kptBoxes.first.clear();
+            input.curr.kptBoxes.first.clear();
+            input.curr.kptMatches = input.matches;
+            map<int, int> bbBestMatches;
+            matchBoundingBoxes(input.curr.kptMatches, bbBestMatches, input.prev, input.curr);
+
+            vector<BoundingBox> &boxes = input.curr.boundingBoxes;
+            byBoxes.add(n, nsPerCall([&] { for (auto &b : boxes) { b.kptMatches.clear(); b.keypoints.clear(); } },
+                                     [&] { for (size_t b = 0; b < boxes.size(); ++b) clusterKptMatchesWithROI((int)b, input.prev, input.curr); }));
+        }
+        byBoxes.print();
+    }
+}
+
+void benchComputeTTCCamera(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    vector<FramePair> inputs(1);
+    inputs[0].name = "synthetic";
+    syntheticKeypointMatches(1600, cv::Rect(500, 150, 200, 150), 1.02f, rng, inputs[0].prev.keypoints, inputs[0].curr.keypoints, inputs[0].matches);
+    if (kitti.bCamera)
+    {
+        // matches of the whole image, the no. of matches per object is smaller
+        inputs.push_back(FramePair());
+        inputs[1].name = "KITTI";
+        inputs[1].prev.keypoints = kitti.kptsPrev;
+        inputs[1].curr.keypoints = kitti.kptsCurr;
+        inputs[1].matches = kitti.matches;
+    }
+
+    for (auto &input : inputs)
+    {
+        ScalingCurve curve("computeTTCCamera", input.name, "match");
+        double TTC = 0;
+        for (size_t n : doublings(25, min<size_t>(1600, input.matches.size())))
+        {
+            vector<cv::DMatch> matches(input.matches.begin(), input.matches.begin() + n);
+            curve.add(n, nsPerCall([] {}, [&] { computeTTCCamera(input.prev.keypoints, input.curr.keypoints, matches, 10.0, TTC); }));
+        }
+        curve.print();
+    }
+}
+
+void benchComputeTTCLidar(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    vector<pair<string, pair<PointCloud, PointCloud>>> inputs = {
+        { "synthetic", { syntheticVehicleCloud(16384, 8.0f, rng), syntheticVehicleCloud(16384, 7.9f, rng) } } };
+    if (kitti.bLidar) inputs.push_back({ "KITTI ego lane", { kitti.egoLanePrev, kitti.egoLaneCurr } });
+
+    for (auto &input : inputs)
+    {
+        ScalingCurve curve("computeTTCLidar", input.first, "point");
+        double TTC = 0;
+        for (size_t n : doublings(128, min(input.second.first.size(), input.second.second.size())))
+        {
+            PointCloud prev = prefix(input.second.first, n), curr = prefix(input.second.second, n);
+            curve.add(n, nsPerCall([] {}, [&] { computeTTCLidar(prev, curr, 10.0, TTC); }));
+        }
+        curve.print();
+    }
+}
+
+void benchCornernessHarris(const KittiFrames &kitti)
+{
+    // smoothed noise has corners all over the image
+    cv::RNG rng(42);
+    cv::Mat noise(imgSize, CV_8U), synthetic;
+    for (int y = 0; y < noise.rows; ++y)
+        for (int x = 0; x < noise.cols; ++x) noise.at<uchar>(y, x) = (uchar)rng.uniform(0, 256);
+    cv::GaussianBlur(noise, synthetic, cv::Size(5, 5), 2.0);
+
+    vector<pair<string, cv::Mat>> inputs = { { "synthetic", synthetic } };
+    if (kitti.bCamera) inputs.push_back({ "KITTI", kitti.imgGray });
+
+    for (auto &input : inputs)
+    {
+        ScalingCurve curve("cornernessHarris", input.first, "pixel");
+        vector<cv::KeyPoint> keypoints;
+        for (double scale : { 0.125, 0.25, 0.5, 1.0, 2.0 })
+        {
+            cv::Mat img;
+            cv::resize(input.second, img, cv::Size(), scale, scale, cv::INTER_LINEAR);
+            curve.add(img.total(), nsPerCall([&] { keypoints.clear(); }, [&] { cornernessHarris(keypoints, img, false); }));
+        }
+        curve.print();
+    }
+}
+
+void benchMatchDescriptors(const KittiFrames &kitti)
+{
+    cv::RNG rng(42);
+    vector<pair<string, pair<cv::Mat, cv::Mat>>> inputs(1);
+    inputs[0].first = "synthetic";
+    syntheticDescriptors(8000, rng, inputs[0].second.first, inputs[0].second.second);
+    if (kitti.bCamera) inputs.push_back({ "KITTI", { kitti.descPrev, kitti.descCurr } });
+
+    vector<pair<string, string>> matchers = { { "MAT_BF", "SEL_NN" }, { "MAT_BF", "SEL_KNN" }, { "MAT_FLANN", "SEL_KNN" } };
+    for (auto &input : inputs)
+    {
+        for (auto &matcher : matchers)
+        {
+            ScalingCurve curve("matchDescriptors " + matcher.first + " " + matcher.second, input.first, "descriptor");
+            vector<cv::DMatch> matches;
+            for (size_t n : doublings(250, min(input.second.first.rows, input.second.second.rows)))
+            {
+                // n descriptors in both frames
+                cv::Mat descSource = input.second.first.rowRange(0, (int)n), descRef = input.second.second.rowRange(0, (int)n);
+                vector<cv::KeyPoint> kPtsSource(n), kPtsRef(n);
+                curve.add(n, nsPerCall([&] { matches.clear(); },
+                                       [&] { matchDescriptors(kPtsSource, kPtsRef, descSource, descRef, matches, "DES_BINARY", matcher.first, matcher.second); }));
+            }
+            curve.print();
+        }
+    }
+}
+
+struct Benchmark
+{
+    const char *kernel;
+    void (*run)(const KittiFrames &);
+};
+
+const Benchmark benchmarks[] = {
+    { "loadLidarFromFile", benchLoadLidarFromFile },
+    { "cropLidarPoints", benchCropLidarPoints },
+    { "clusterLidarWithROI", benchClusterLidarWithROI },
+    { "matchBoundingBoxes", benchMatchBoundingBoxes },
+    { "clusterKptMatchesWithROI", benchClusterKptMatchesWithROI },
+    { "computeTTCCamera", benchComputeTTCCamera },
+    { "computeTTCLidar", benchComputeTTCLidar },
+    { "cornernessHarris", benchCornernessHarris },
+    { "matchDescriptors", benchMatchDescriptors },
+};
+
+} // namespace
+
+// usage: camera_fusion_bench [kernel], runs the benchmarks of all kernels whose name contains the argument
+int main(int argc, const char *argv[])
+{
+    string filter = argc > 1 ? argv[1] : "";
+
+    KittiFrames kitti = loadKitti();
+    if (!kitti.bLidar) cout << "KITTI Lidar scans not found in " << kittiPrefix << ", Lidar kernels run on synthetic inputs only" << endl;
+    if (!kitti.bCamera) cout << "KITTI camera images not found in " << kittiPrefix << ", camera kernels run on synthetic inputs only" << endl;
+
+    cout << "kernel | input | element | n | ns/call | ns/element | exponent" << endl;
+    for (auto &benchmark : benchmarks)
+    {
+        if (filter.empty() || string(benchmark.kernel).find(filter) != string::npos) benchmark.run(kitti);
+    }
+    return 0;
+}
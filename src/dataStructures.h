@@ -4,10 +4,17 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
 
-struct LidarPoint { // single lidar point in space
-    double x,y,z,r; // x,y,z in [m], r is point reflectivity
+#include "pointCloud.hpp"
+
+struct LidarStats { // summary of the Lidar points of a bounding box, computed once when the box is filled
+    int numPoints = 0;
+    float xMin = 0, xMax = 0, yMin = 0, yMax = 0, zMin = 0, zMax = 0; // extents in [m]
+    float xClosest = 1e8; // distance with outliers removed: median x of the closest points (1e8 without points)
+    float zClosest = 0; // z of the point at xClosest
 };
 
 struct BoundingBox { // bounding box around a classified object (contains both 2D and 3D data)
@@ -19,22 +26,46 @@ struct BoundingBox { // bounding box around a classified object (contains both 2
     int classID; // ID based on class file provided to YOLO framework
     double confidence; // classification trust
 
-    std::vector<LidarPoint> lidarPoints; // Lidar 3D points which project into 2D image roi
+    PointCloud lidarPoints; // Lidar 3D points which project into 2D image roi
+    std::vector<cv::Point> lidarImgPoints; // image coordinates of lidarPoints (same order)
+    LidarStats lidarStats; // summary of lidarPoints
     std::vector<cv::KeyPoint> keypoints; // keypoints enclosed by 2D roi
     std::vector<cv::DMatch> kptMatches; // keypoint matches enclosed by 2D roi
+
+    cv::Point2f kptMotion; // median image motion of the keypoint matches enclosed by roi since the previous frame [px]
+    int kptMotionSupport = 0; // no. of matches kptMotion was estimated from
+};
+
+struct IndexBuckets { // variable-length index lists stored in one flat array
+    std::vector<int> first; // bucket i holds indices[first[i]] ... indices[first[i+1]-1]
+    std::vector<int> indices;
+
+    size_t size() const { return first.empty() ? 0 : first.size() - 1; }
+    const int *begin(size_t i) const { return indices.data() + first[i]; }
+    const int *end(size_t i) const { return indices.data() + first[i + 1]; }
 };
 
 struct DataFrame { // represents the available sensor information at the same time instance
     
-    cv::Mat cameraImg; // camera image
+    std::shared_ptr<const cv::Mat> cameraImg; // camera image, shared by all runs through FrameStore
+    cv::Mat cameraImgGray; // grayscale cameraImg, shared by keypoint detection and description
+    std::vector<cv::Mat> cameraPyramid; // optical flow pyramid of cameraImgGray, built once per frame for KLT tracking
     
     std::vector<cv::KeyPoint> keypoints; // 2D keypoints within camera image
     cv::Mat descriptors; // keypoint descriptors
+    cv::Ptr<cv::DescriptorMatcher> descriptorIndex; // search index trained on descriptors (MAT_FLANN only)
     std::vector<cv::DMatch> kptMatches; // keypoint matches between previous and current frame
-    std::vector<LidarPoint> lidarPoints;
+    PointCloud lidarPoints;
+    std::vector<cv::Point> lidarImgPoints; // image coordinates of lidarPoints (same order), projected once per frame
 
     std::vector<BoundingBox> boundingBoxes; // ROI around detected objects in 2D image coordinates
     std::map<int,int> bbMatches; // bounding box matches between previous and current frame
+
+    IndexBuckets kptBoxes; // per keypoint: indices of the bounding boxes enclosing it
+    IndexBuckets boxKptMatches; // per bounding box: indices into kptMatches whose current keypoint it encloses
+
+    cv::Point2f kptMotion; // median image motion of all kptMatches [px]
+    int kptMotionSupport = 0; // no. of matches kptMotion was estimated from
 };
 
 #endif /* dataStructures_h */
@@ -0,0 +1,170 @@
+#include <sstream>
+#include <stdexcept>
+
+#include "featurePipeline.hpp"
+#include "hammingMatcher.hpp"
+
+using namespace std;
+
+std::string DetectionTiling::key() const
+{
+    ostringstream key;
+    if (tilesX * tilesY > 1) key << "|tiles" << tilesX << "x" << tilesY << "+" << overlap;
+    if (maxKeypointsPerTile > 0) key << "|maxPerTile" << maxKeypointsPerTile;
+    if (maxKeypoints > 0) key << "|max" << maxKeypoints;
+    return key.str();
+}
+
+FeaturePipeline::FeaturePipeline(const std::string &detectorName, const std::string &descriptorName,
+                                 const std::string &matcherName, const std::string &selectorName)
+    : detector_type(parseDetectorType(detectorName)), descriptor_type(parseDescriptorType(descriptorName)),
+      matcher_type(parseMatcherType(matcherName)), selector_type(parseSelectorType(selectorName))
+{
+    detector = createDetector(detector_type);
+    extractor = createDescriptorExtractor(descriptor_type);
+    matcher = createMatcher(matcher_type, binaryDescriptors(), selector_type);
+}
+
+void FeaturePipeline::setTiling(const DetectionTiling &tiling)
+{
+    if (tiling.tilesX < 1 || tiling.tilesY < 1 || tiling.overlap < 0)
+        throw invalid_argument("FeaturePipeline: invalid detection tiling");
+    this->tiling = tiling;
+
+    int nTiles = tiling.tilesX * tiling.tilesY;
+    tileDetectors.clear();
+    for (int t = 0; nTiles > 1 && t < nTiles; ++t)
+    {
+        cv::Ptr<cv::FeatureDetector> tileDetector = createDetector(detector_type);
+        if (detector_type == DetectorType::ORB)
+        {
+            // nfeatures applies to the image the detector is run on, each tile gets its share of the image budget
+            cv::ORB *orb = static_cast<cv::ORB *>(tileDetector.get());
+            orb->setMaxFeatures((orb->getMaxFeatures() + nTiles - 1) / nTiles);
+        }
+        tileDetectors.push_back(tileDetector);
+    }
+    tileKeypoints.resize(nTiles > 1 ? nTiles : 0);
+}
+
+void FeaturePipeline::detect(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, bool bVis)
+{
+    bool bTiled = tiling.tilesX * tiling.tilesY > 1;
+    if (bTiled) detectTiled(imgGray, keypoints);
+    else detectWith(detector.get(), imgGray, keypoints, bVis);
+
+    // without tiling, the whole image is the only tile
+    if (!bTiled && tiling.maxKeypointsPerTile > 0) cv::KeyPointsFilter::retainBest(keypoints, tiling.maxKeypointsPerTile);
+    if (tiling.maxKeypoints > 0) cv::KeyPointsFilter::retainBest(keypoints, tiling.maxKeypoints);
+}
+
+void FeaturePipeline::detectWith(cv::FeatureDetector *tileDetector, cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, bool bVis) const
+{
+    switch (detector_type)
+    {
+    case DetectorType::SHITOMASI:
+        detKeypointsShiTomasi(keypoints, imgGray, bVis);
+        break;
+    case DetectorType::HARRIS:
+        detKeypointsHarris(keypoints, imgGray, bVis);
+        break;
+    case DetectorType::HARRIS_GFT:
+        detKeypointsHarrisWithGoodFeaturesToTrack(keypoints, imgGray, bVis);
+        break;
+    default:
+        tileDetector->detect(imgGray, keypoints);
+        break;
+    }
+}
+
+void FeaturePipeline::detectTiled(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints)
+{
+    int width = imgGray.cols, height = imgGray.rows;
+    cv::parallel_for_(cv::Range(0, (int)tileKeypoints.size()), [&](const cv::Range &range)
+    {
+        for (int t = range.start; t < range.end; ++t)
+        {
+            // the cores of the tiles partition the image, each tile is detected on its core plus the overlap
+            int tx = t % tiling.tilesX, ty = t / tiling.tilesX;
+            int x0 = tx * width / tiling.tilesX, x1 = (tx + 1) * width / tiling.tilesX;
+            int y0 = ty * height / tiling.tilesY, y1 = (ty + 1) * height / tiling.tilesY;
+            cv::Rect region = cv::Rect(x0 - tiling.overlap, y0 - tiling.overlap, x1 - x0 + 2 * tiling.overlap, y1 - y0 + 2 * tiling.overlap) &
+                              cv::Rect(0, 0, width, height);
+
+            cv::Mat tileGray = imgGray(region);
+            vector<cv::KeyPoint> &kpts = tileKeypoints[t];
+            kpts.clear();
+            detectWith(tileDetectors[t].get(), tileGray, kpts, false);
+
+            // a keypoint found by several tiles in their overlap is only kept by the tile whose core contains it
+            size_t n = 0;
+            for (auto &kpt : kpts)
+            {
+                kpt.pt.x += region.x;
+                kpt.pt.y += region.y;
+                if (kpt.pt.x >= x0 && kpt.pt.x < x1 && kpt.pt.y >= y0 && kpt.pt.y < y1) kpts[n++] = kpt;
+            }
+            kpts.resize(n);
+            if (tiling.maxKeypointsPerTile > 0) cv::KeyPointsFilter::retainBest(kpts, tiling.maxKeypointsPerTile);
+        }
+    });
+
+    keypoints.clear();
+    for (auto &kpts : tileKeypoints) keypoints.insert(keypoints.end(), kpts.begin(), kpts.end());
+}
+
+void FeaturePipeline::describe(std::vector<cv::KeyPoint> &keypoints, cv::Mat &imgGray, cv::Mat &descriptors)
+{
+    extractor->compute(imgGray, keypoints, descriptors);
+}
+
+bool FeaturePipeline::fusedDetectDescribe() const
+{
+    if (tiling.tilesX * tiling.tilesY > 1 || tiling.maxKeypointsPerTile > 0 || tiling.maxKeypoints > 0) return false;
+    switch (detector_type)
+    {
+    case DetectorType::BRISK: return descriptor_type == DescriptorType::BRISK;
+    case DetectorType::ORB: return descriptor_type == DescriptorType::ORB;
+    case DetectorType::AKAZE: return descriptor_type == DescriptorType::AKAZE;
+    case DetectorType::SIFT: return descriptor_type == DescriptorType::SIFT;
+    default: return false;
+    }
+}
+
+void FeaturePipeline::detectAndDescribe(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors)
+{
+    if (!fusedDetectDescribe())
+    {
+        detect(imgGray, keypoints);
+        describe(keypoints, imgGray, descriptors);
+        return;
+    }
+    // the detector instance has the same descriptor parameters as the extractor (ORB differs in nfeatures only)
+    detector->detectAndCompute(imgGray, cv::noArray(), keypoints, descriptors);
+}
+
+void FeaturePipeline::match(const cv::Mat &descSource, const cv::Mat &descRef, std::vector<cv::DMatch> &matches)
+{
+    if (matcher_type == MatcherType::MAT_BF && selector_type == SelectorType::SEL_KNN && binaryDescriptors())
+    {
+        // same result as brute-force kNN matching with the ratio test of selectMatches(), without the kNN lists
+        matchHammingKnnRatio(descSource, descRef, matches);
+        return;
+    }
+    selectMatches(*matcher, descSource, &descRef, matches, selector_type, knnMatches);
+}
+
+cv::Ptr<cv::DescriptorMatcher> FeaturePipeline::buildIndex(const cv::Mat &descriptors) const
+{
+    if (matcher_type != MatcherType::MAT_FLANN || descriptors.empty()) return cv::Ptr<cv::DescriptorMatcher>();
+
+    cv::Ptr<cv::DescriptorMatcher> index = matcher->clone(true); // same parameters, without training data
+    index->add(std::vector<cv::Mat>(1, descriptors));
+    index->train();
+    return index;
+}
+
+void FeaturePipeline::match(const cv::Mat &descSource, cv::DescriptorMatcher &refIndex, std::vector<cv::DMatch> &matches)
+{
+    selectMatches(refIndex, descSource, nullptr, matches, selector_type, knnMatches);
+}
@@ -0,0 +1,85 @@
+
+#ifndef featurePipeline_hpp
+#define featurePipeline_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "matching2D.hpp"
+
+// Optional split of keypoint detection into overlapping tiles which are processed in parallel, and keypoint budgets.
+// Detectors whose threshold is relative to the strongest response in the image (Harris, Shi-Tomasi) apply it per tile.
+// A detector's own feature budget (ORB's nfeatures) is split evenly across the tiles, so tiling does not multiply it.
+struct DetectionTiling
+{
+    int tilesX = 1, tilesY = 1;  // no. of tiles, 1 x 1 disables tiling
+    int overlap = 32;            // margin [px] added around each tile, should cover the detector's border (e.g. ORB edgeThreshold)
+    int maxKeypointsPerTile = 0; // keep the strongest keypoints of each tile, 0 for no limit
+    int maxKeypoints = 0;        // keep the strongest keypoints of the image, 0 for no limit
+
+    // empty for the defaults, otherwise a description of the settings for artifact cache keys
+    std::string key() const;
+};
+
+// Keypoint detection, description and matching for a whole image sequence. The configuration names are parsed
+// into enums once and the OpenCV algorithm objects are created up front, so they (and their internal buffers)
+// are reused for every frame. Detection and description may run on a different thread than matching, but each
+// of them must not be called concurrently.
+class FeaturePipeline
+{
+public:
+    // throws std::invalid_argument for unknown names
+    FeaturePipeline(const std::string &detectorName, const std::string &descriptorName,
+                    const std::string &matcherName = "MAT_BF", const std::string &selectorName = "SEL_KNN");
+
+    // all detectors and descriptors work on the grayscale image, which OpenCV would otherwise convert on every call;
+    // OpenCV's detectors and extractors build their scale pyramids internally and cannot take an external one, so the
+    // pyramid kept with the frame (DataFrame::cameraPyramid) only serves optical flow
+    void detect(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, bool bVis = false);
+    void describe(std::vector<cv::KeyPoint> &keypoints, cv::Mat &imgGray, cv::Mat &descriptors);
+
+    // true if detector and descriptor are the same algorithm (BRISK, ORB, AKAZE, SIFT) and detect() would not change
+    // the keypoints by tiling or budgets: detectAndDescribe() then builds the scale pyramid once for both steps
+    bool fusedDetectDescribe() const;
+    void detectAndDescribe(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors);
+    void match(const cv::Mat &descSource, const cv::Mat &descRef, std::vector<cv::DMatch> &matches);
+
+    // MAT_FLANN: builds a search index over the descriptors of a frame, which can be passed to match() whenever the
+    // frame is the reference, e.g. while the next frame is being processed. Returns an empty pointer for MAT_BF.
+    cv::Ptr<cv::DescriptorMatcher> buildIndex(const cv::Mat &descriptors) const;
+    void match(const cv::Mat &descSource, cv::DescriptorMatcher &refIndex, std::vector<cv::DMatch> &matches);
+
+    DetectorType detectorType() const { return detector_type; }
+    DescriptorType descriptorType() const { return descriptor_type; }
+    MatcherType matcherType() const { return matcher_type; }
+    SelectorType selectorType() const { return selector_type; }
+    bool binaryDescriptors() const { return descriptor_type != DescriptorType::SIFT; } // SIFT uses float
+
+    void setTiling(const DetectionTiling &tiling);
+    const DetectionTiling &detectionTiling() const { return tiling; }
+
+private:
+    void detectWith(cv::FeatureDetector *tileDetector, cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints, bool bVis) const;
+    void detectTiled(cv::Mat &imgGray, std::vector<cv::KeyPoint> &keypoints);
+
+    DetectorType detector_type;
+    DescriptorType descriptor_type;
+    MatcherType matcher_type;
+    SelectorType selector_type;
+
+    cv::Ptr<cv::FeatureDetector> detector; // empty for the classic corner detectors
+    cv::Ptr<cv::DescriptorExtractor> extractor;
+    cv::Ptr<cv::DescriptorMatcher> matcher;
+
+    DetectionTiling tiling;
+    std::vector<cv::Ptr<cv::FeatureDetector>> tileDetectors; // one per tile, OpenCV detectors are not guaranteed to be reentrant
+    std::vector<std::vector<cv::KeyPoint>> tileKeypoints;
+
+    // buffer reused across frames
+    std::vector<std::vector<cv::DMatch>> knnMatches;
+};
+
+#endif /* featurePipeline_hpp */
@@ -0,0 +1,173 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <opencv2/imgcodecs.hpp>
+
+#include "frameStore.hpp"
+#include "lidarData.hpp"
+
+using namespace std;
+
+FrameStore &FrameStore::instance()
+{
+    static FrameStore store;
+    return store;
+}
+
+FrameStore::FrameStore() : budget(512 * 1024 * 1024), usedBytes(0) // enough for the images and scans of the bundled sequence
+{
+}
+
+void FrameStore::setMemoryBudget(size_t bytes)
+{
+    lock_guard<mutex> lock(storeMutex);
+    budget = bytes;
+    evict();
+}
+
+size_t FrameStore::memoryBudget()
+{
+    lock_guard<mutex> lock(storeMutex);
+    return budget;
+}
+
+std::shared_ptr<const cv::Mat> FrameStore::image(const std::string &filename)
+{
+    shared_ptr<const void> data = get("img:" + filename, [&filename](size_t &bytes)
+    {
+        shared_ptr<cv::Mat> img = make_shared<cv::Mat>(cv::imread(filename));
+        if (img->empty()) throw runtime_error("cannot read image " + filename);
+        bytes = img->total() * img->elemSize();
+        return shared_ptr<const void>(img);
+    });
+    return static_pointer_cast<const cv::Mat>(data);
+}
+
+std::shared_ptr<const PointCloud> FrameStore::lidarPoints(const std::string &filename)
+{
+    shared_ptr<const void> data = get("lidar:" + filename, [&filename](size_t &bytes)
+    {
+        shared_ptr<PointCloud> scan = make_shared<PointCloud>();
+        if (!loadLidarFromFile(*scan, filename)) throw runtime_error("cannot read Lidar scan " + filename);
+        bytes = scan->size() * 4 * sizeof(float);
+        return shared_ptr<const void>(scan);
+    });
+    return static_pointer_cast<const PointCloud>(data);
+}
+
+std::shared_ptr<const PointCloud> FrameStore::lidarPoints(const std::string &filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    ostringstream key;
+    key << "lidar:" << filename << "|" << minX << "|" << maxX << "|" << maxY << "|" << minZ << "|" << maxZ << "|" << minR;
+    shared_ptr<const void> data = get(key.str(), [&](size_t &bytes)
+    {
+        shared_ptr<PointCloud> scan = make_shared<PointCloud>();
+        if (!loadLidarFromFile(*scan, filename, minX, maxX, maxY, minZ, maxZ, minR)) throw runtime_error("cannot read Lidar scan " + filename);
+        bytes = scan->size() * 4 * sizeof(float);
+        return shared_ptr<const void>(scan);
+    });
+    return static_pointer_cast<const PointCloud>(data);
+}
+
+std::shared_ptr<const std::vector<BoundingBox>> FrameStore::boundingBoxes(const std::string &key, std::function<std::vector<BoundingBox>()> detect)
+{
+    shared_ptr<const void> data = get("yolo:" + key, [&detect](size_t &bytes)
+    {
+        shared_ptr<vector<BoundingBox>> bBoxes = make_shared<vector<BoundingBox>>(detect());
+        bytes = bBoxes->size() * sizeof(BoundingBox);
+        return shared_ptr<const void>(bBoxes);
+    });
+    return static_pointer_cast<const vector<BoundingBox>>(data);
+}
+
+bool FrameStore::hasBoundingBoxes(const std::string &key)
+{
+    lock_guard<mutex> lock(storeMutex);
+    return entries.count("yolo:" + key) > 0;
+}
+
+void FrameStore::clear()
+{
+    lock_guard<mutex> lock(storeMutex);
+    size_t savedBudget = budget;
+    budget = 0;
+    evict();
+    budget = savedBudget;
+}
+
+// returns the decoded data for key; the first caller decodes it while concurrent callers wait for the result
+std::shared_ptr<const void> FrameStore::get(const std::string &key, std::function<std::shared_ptr<const void>(size_t &)> load)
+{
+    promise<shared_ptr<const void>> loadPromise;
+    shared_future<shared_ptr<const void>> data;
+    bool bLoad = false;
+    {
+        lock_guard<mutex> lock(storeMutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            lru.splice(lru.begin(), lru, it->second.lruPos);
+            data = it->second.data;
+        }
+        else
+        {
+            lru.push_front(key);
+            Entry &entry = entries[key];
+            entry.data = loadPromise.get_future().share();
+            entry.bytes = 0;
+            entry.lruPos = lru.begin();
+            data = entry.data;
+            bLoad = true;
+        }
+    }
+
+    if (bLoad)
+    {
+        size_t bytes = 0;
+        bool bFailed = false;
+        try
+        {
+            loadPromise.set_value(load(bytes));
+        }
+        catch (...)
+        {
+            loadPromise.set_exception(current_exception());
+            bFailed = true;
+        }
+
+        lock_guard<mutex> lock(storeMutex);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            if (bFailed) // waiting callers get the exception, later ones retry
+            {
+                lru.erase(it->second.lruPos);
+                entries.erase(it);
+            }
+            else
+            {
+                it->second.bytes = bytes;
+                usedBytes += bytes;
+                evict();
+            }
+        }
+    }
+
+    return data.get();
+}
+
+// drop least recently used entries until the budget is met; entries still being decoded are kept (caller holds storeMutex)
+void FrameStore::evict()
+{
+    auto it = lru.end();
+    while (usedBytes > budget && it != lru.begin())
+    {
+        --it;
+        auto entry = entries.find(*it);
+        if (entry->second.data.wait_for(chrono::seconds(0)) != future_status::ready) continue;
+        usedBytes -= entry->second.bytes;
+        entries.erase(entry);
+        it = lru.erase(it);
+    }
+}
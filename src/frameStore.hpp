@@ -0,0 +1,65 @@
+
+#ifndef frameStore_hpp
+#define frameStore_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <opencv2/core.hpp>
+
+#include "dataStructures.h"
+
+// Process-wide store of decoded camera images, the YOLO detections on them and the (cropped) Lidar scans. Each file is
+// decoded and each detection computed once and handed out as shared, read-only data to any number of (concurrent)
+// pipeline runs. Entries are evicted in least-recently-used
+// order once the memory budget is exceeded; data still held by a run stays alive until the run releases it.
+class FrameStore
+{
+public:
+    static FrameStore &instance();
+
+    void setMemoryBudget(size_t bytes);
+    size_t memoryBudget();
+
+    // the returned image is shared with the store and all other runs, callers which draw on it must clone it first;
+    // throws std::runtime_error if the file cannot be read (failures are not cached, the next call tries again)
+    std::shared_ptr<const cv::Mat> image(const std::string &filename);
+
+    // the whole scan or the points within the given crop region (see loadLidarFromFile), read and cropped once per
+    // file and region; throws std::runtime_error if the file cannot be read or is truncated (not cached either)
+    std::shared_ptr<const PointCloud> lidarPoints(const std::string &filename);
+    std::shared_ptr<const PointCloud> lidarPoints(const std::string &filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+
+    // detections for key (image and detector settings), computed by detect() on the first request;
+    // hasBoundingBoxes() is true as soon as they are stored or being computed
+    std::shared_ptr<const std::vector<BoundingBox>> boundingBoxes(const std::string &key, std::function<std::vector<BoundingBox>()> detect);
+    bool hasBoundingBoxes(const std::string &key);
+
+    void clear();
+
+private:
+    FrameStore();
+
+    struct Entry {
+        std::shared_future<std::shared_ptr<const void>> data; // ready once the file has been decoded
+        size_t bytes; // memory held by data, 0 while decoding
+        std::list<std::string>::iterator lruPos;
+    };
+
+    std::shared_ptr<const void> get(const std::string &key, std::function<std::shared_ptr<const void>(size_t &)> load);
+    void evict();
+
+    std::mutex storeMutex;
+    std::map<std::string, Entry> entries;
+    std::list<std::string> lru; // most recently used key first
+    size_t budget;
+    size_t usedBytes;
+};
+
+#endif /* frameStore_hpp */
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "guidedMatching.hpp"
+#include "hammingMatcher.hpp"
+
+using namespace std;
+
+namespace
+{
+
+// keypoint positions bucketed into square cells, for radius queries
+class KeypointGrid
+{
+public:
+    KeypointGrid(const vector<cv::KeyPoint> &keypoints, float cellSize) : cellSize(cellSize), nCellsX(0), nCellsY(0)
+    {
+        if (keypoints.empty()) return;
+        origin = extent = keypoints[0].pt;
+        for (auto &kpt : keypoints)
+        {
+            origin.x = min(origin.x, kpt.pt.x);
+            origin.y = min(origin.y, kpt.pt.y);
+            extent.x = max(extent.x, kpt.pt.x);
+            extent.y = max(extent.y, kpt.pt.y);
+        }
+        nCellsX = (int)((extent.x - origin.x) / cellSize) + 1;
+        nCellsY = (int)((extent.y - origin.y) / cellSize) + 1;
+
+        // count keypoints per cell, then fill the flat index array (counting sort, ascending indices per cell)
+        cellStart.assign(nCellsX * nCellsY + 1, 0);
+        for (auto &kpt : keypoints) cellStart[cellOf(kpt.pt) + 1]++;
+        for (size_t c = 1; c < cellStart.size(); ++c) cellStart[c] += cellStart[c - 1];
+        cellKpts.resize(keypoints.size());
+        vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < keypoints.size(); ++i) cellKpts[fill[cellOf(keypoints[i].pt)]++] = (int)i;
+        pts.reserve(keypoints.size());
+        for (auto &kpt : keypoints) pts.push_back(kpt.pt);
+    }
+
+    // appends the indices of all keypoints within radius of pt, in ascending order
+    void query(cv::Point2f pt, float radius, vector<int> &indices) const
+    {
+        if (nCellsX == 0) return;
+        int cx0 = max(0, (int)floor((pt.x - radius - origin.x) / cellSize)), cx1 = min(nCellsX - 1, (int)floor((pt.x + radius - origin.x) / cellSize));
+        int cy0 = max(0, (int)floor((pt.y - radius - origin.y) / cellSize)), cy1 = min(nCellsY - 1, (int)floor((pt.y + radius - origin.y) / cellSize));
+        size_t first = indices.size();
+        for (int cy = cy0; cy <= cy1; ++cy)
+            for (int cx = cx0; cx <= cx1; ++cx)
+            {
+                int c = cy * nCellsX + cx;
+                for (int k = cellStart[c]; k < cellStart[c + 1]; ++k)
+                {
+                    cv::Point2f d = pts[cellKpts[k]] - pt;
+                    if (d.x * d.x + d.y * d.y <= radius * radius) indices.push_back(cellKpts[k]);
+                }
+            }
+        sort(indices.begin() + first, indices.end());
+    }
+
+private:
+    int cellOf(cv::Point2f pt) const
+    {
+        return (int)((pt.y - origin.y) / cellSize) * nCellsX + (int)((pt.x - origin.x) / cellSize);
+    }
+
+    float cellSize;
+    int nCellsX, nCellsY;
+    cv::Point2f origin, extent;
+    vector<int> cellStart; // keypoints of cell c are cellKpts[cellStart[c]] ... cellKpts[cellStart[c+1]-1]
+    vector<int> cellKpts;
+    vector<cv::Point2f> pts;
+};
+
+// component-wise median of the displacements of the given matches
+cv::Point2f medianMotion(const DataFrame &prevFrame, const DataFrame &currFrame, const int *first, const int *last,
+                         vector<float> &dx, vector<float> &dy)
+{
+    dx.clear();
+    dy.clear();
+    for (const int *it = first; it != last; ++it)
+    {
+        const cv::DMatch &match = currFrame.kptMatches[*it];
+        cv::Point2f d = currFrame.keypoints[match.trainIdx].pt - prevFrame.keypoints[match.queryIdx].pt;
+        dx.push_back(d.x);
+        dy.push_back(d.y);
+    }
+    nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+    nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+    return cv::Point2f(dx[dx.size() / 2], dy[dy.size() / 2]);
+}
+
+// like matchHammingKnnRatio() for float descriptors (SIFT) by L2 distance
+void matchL2KnnRatio(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets &candidates,
+                     vector<cv::DMatch> &matches, double minDescDistRatio)
+{
+    // query rows are matched in parallel, each into its own slot; rows without a match keep trainIdx -1
+    matches.assign(descSource.rows, cv::DMatch());
+    cv::DMatch *out = matches.data();
+    cv::parallel_for_(cv::Range(0, descSource.rows), [&](const cv::Range &rows)
+    {
+        for (int q = rows.start; q < rows.end; ++q)
+        {
+            float best = numeric_limits<float>::max(), secondBest = best;
+            int bestIdx = -1;
+            for (const int *it = candidates.begin(q); it != candidates.end(q); ++it)
+            {
+                float d = (float)cv::norm(descSource.row(q), descRef.row(*it), cv::NORM_L2);
+                if (d < best)
+                {
+                    secondBest = best;
+                    best = d;
+                    bestIdx = *it;
+                }
+                else if (d < secondBest)
+                {
+                    secondBest = d;
+                }
+            }
+            if (secondBest != numeric_limits<float>::max() && best < minDescDistRatio * secondBest)
+                out[q] = cv::DMatch(q, bestIdx, best);
+        }
+    });
+
+    // compact in query order
+    matches.erase(remove_if(matches.begin(), matches.end(), [](const cv::DMatch &m) { return m.trainIdx < 0; }), matches.end());
+}
+
+} // namespace
+
+void estimateKeypointMotion(const DataFrame &prevFrame, DataFrame &currFrame)
+{
+    vector<float> dx, dy;
+    vector<int> all(currFrame.kptMatches.size());
+    for (size_t m = 0; m < all.size(); ++m) all[m] = (int)m;
+    currFrame.kptMotionSupport = (int)all.size();
+    currFrame.kptMotion = all.empty() ? cv::Point2f() : medianMotion(prevFrame, currFrame, all.data(), all.data() + all.size(), dx, dy);
+
+    if (currFrame.boxKptMatches.size() != currFrame.boundingBoxes.size()) return; // matches have not been bucketed
+    for (size_t b = 0; b < currFrame.boundingBoxes.size(); ++b)
+    {
+        BoundingBox &box = currFrame.boundingBoxes[b];
+        const int *first = currFrame.boxKptMatches.begin(b), *last = currFrame.boxKptMatches.end(b);
+        box.kptMotionSupport = (int)(last - first);
+        box.kptMotion = first == last ? cv::Point2f() : medianMotion(prevFrame, currFrame, first, last, dx, dy);
+    }
+}
+
+void matchDescriptorsGuided(const DataFrame &prevFrame, const DataFrame &currFrame, float searchRadius,
+                            std::vector<cv::DMatch> &matches, double minDescDistRatio, int minBoxSupport)
+{
+    if (searchRadius <= 0) throw invalid_argument("matchDescriptorsGuided: searchRadius must be positive");
+    bool bBoxes = prevFrame.kptBoxes.size() == prevFrame.keypoints.size();
+
+    // candidate current keypoints around the predicted position of each previous keypoint
+    KeypointGrid grid(currFrame.keypoints, searchRadius);
+    IndexBuckets candidates;
+    candidates.first.assign(1, 0);
+    candidates.first.reserve(prevFrame.keypoints.size() + 1);
+    for (size_t i = 0; i < prevFrame.keypoints.size(); ++i)
+    {
+        cv::Point2f motion = prevFrame.kptMotion;
+        if (bBoxes && prevFrame.kptBoxes.end(i) - prevFrame.kptBoxes.begin(i) == 1)
+        {
+            const BoundingBox &box = prevFrame.boundingBoxes[*prevFrame.kptBoxes.begin(i)];
+            if (box.kptMotionSupport >= minBoxSupport) motion = box.kptMotion;
+        }
+        grid.query(prevFrame.keypoints[i].pt + motion, searchRadius, candidates.indices);
+        candidates.first.push_back((int)candidates.indices.size());
+    }
+
+    if (prevFrame.descriptors.type() == CV_8U)
+        matchHammingKnnRatio(prevFrame.descriptors, currFrame.descriptors, candidates, matches, minDescDistRatio);
+    else
+        matchL2KnnRatio(prevFrame.descriptors, currFrame.descriptors, candidates, matches, minDescDistRatio);
+}
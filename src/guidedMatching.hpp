@@ -0,0 +1,23 @@
+
+#ifndef guidedMatching_hpp
+#define guidedMatching_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "dataStructures.h"
+
+// Estimates the image motion of currFrame's keypoints from its kptMatches (query: prevFrame, train: currFrame),
+// per bounding box from currFrame.boxKptMatches (filled by matchBoundingBoxes) and over all matches.
+void estimateKeypointMotion(const DataFrame &prevFrame, DataFrame &currFrame);
+
+// Matches prevFrame's descriptors (query) against currFrame's (train) with the k=2 distance ratio test, comparing
+// each previous keypoint only with the current keypoints within searchRadius [px] of its predicted position. The
+// prediction assumes constant image velocity: a keypoint moves by the kptMotion of the one prevFrame bounding box
+// enclosing it, or by the frame's kptMotion if there is no such box with at least minBoxSupport matches.
+// prevFrame needs kptBoxes (mapKeypointsToBoxes) and a motion estimate (estimateKeypointMotion).
+void matchDescriptorsGuided(const DataFrame &prevFrame, const DataFrame &currFrame, float searchRadius,
+                            std::vector<cv::DMatch> &matches, double minDescDistRatio = 0.8, int minBoxSupport = 5);
+
+#endif /* guidedMatching_hpp */
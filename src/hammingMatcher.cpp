@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "hammingMatcher.hpp"
+
+// x86 SIMD kernels are compiled for their instruction set by function attributes and selected at runtime,
+// independent of the target of the build
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAMMING_SIMD_DISPATCH
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512vl,avx512vpopcntdq")))
+#endif
+
+using namespace std;
+
+namespace
+{
+
+inline uint64_t load64(const uchar *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline int popCount64(uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(v);
+#else
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Each kernel holds one query descriptor and returns its Hamming distance to a reference descriptor of the same length
+
+// any row length
+class ScalarKernel
+{
+public:
+    ScalarKernel(const uchar *query, int len) : query(query), len(len) {}
+
+    int operator()(const uchar *ref) const
+    {
+        int d = 0, i = 0;
+        for (; i + 8 <= len; i += 8) d += popCount64(load64(query + i) ^ load64(ref + i));
+        for (; i < len; ++i) d += popCount64(query[i] ^ ref[i]);
+        return d;
+    }
+
+private:
+    const uchar *query;
+    int len;
+};
+
+// rows of N bytes, loop unrolled by the compiler
+template <int N>
+class FixedScalarKernel
+{
+public:
+    FixedScalarKernel(const uchar *query, int)
+    {
+        for (int i = 0; i < N / 8; ++i) q[i] = load64(query + 8 * i);
+    }
+
+    int operator()(const uchar *ref) const
+    {
+        int d = 0;
+        for (int i = 0; i < N / 8; ++i) d += popCount64(q[i] ^ load64(ref + 8 * i));
+        return d;
+    }
+
+private:
+    uint64_t q[N / 8];
+};
+
+#ifdef HAMMING_SIMD_DISPATCH
+// sum of the four 64 bit lanes
+TARGET_AVX2 inline int sumLanes(__m256i v)
+{
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi64(s, _mm_unpackhi_epi64(s, s)));
+}
+
+// bit counts of each byte by nibble table lookup (no vector popcount in AVX2)
+TARGET_AVX2 inline __m256i popCountBytes(__m256i v)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, lowNibbles));
+    __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibbles));
+    return _mm256_add_epi8(lo, hi);
+}
+
+// rows of N = 32 (BRIEF, ORB) or 64 bytes (BRISK, FREAK); byte counts are summed before the horizontal reduction
+template <int N>
+class Avx2Kernel
+{
+public:
+    TARGET_AVX2 Avx2Kernel(const uchar *query, int)
+    {
+        for (int i = 0; i < N / 32; ++i) q[i] = _mm256_loadu_si256((const __m256i *)(query + 32 * i));
+    }
+
+    TARGET_AVX2 int operator()(const uchar *ref) const
+    {
+        __m256i counts = popCountBytes(_mm256_xor_si256(q[0], _mm256_loadu_si256((const __m256i *)ref)));
+        for (int i = 1; i < N / 32; ++i)
+            counts = _mm256_add_epi8(counts, popCountBytes(_mm256_xor_si256(q[i], _mm256_loadu_si256((const __m256i *)(ref + 32 * i)))));
+        return sumLanes(_mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+
+private:
+    __m256i q[N / 32];
+};
+
+// rows of 32 bytes, native 64 bit popcount
+class Avx512Kernel32
+{
+public:
+    TARGET_AVX512 Avx512Kernel32(const uchar *query, int) : q(_mm256_loadu_si256((const __m256i *)query)) {}
+
+    TARGET_AVX512 int operator()(const uchar *ref) const
+    {
+        return sumLanes(_mm256_popcnt_epi64(_mm256_xor_si256(q, _mm256_loadu_si256((const __m256i *)ref))));
+    }
+
+private:
+    __m256i q;
+};
+
+// rows of 64 bytes
+class Avx512Kernel64
+{
+public:
+    TARGET_AVX512 Avx512Kernel64(const uchar *query, int) : q(_mm512_loadu_si512(query)) {}
+
+    TARGET_AVX512 int operator()(const uchar *ref) const
+    {
+        return (int)_mm512_reduce_add_epi64(_mm512_popcnt_epi64(_mm512_xor_si512(q, _mm512_loadu_si512(ref))));
+    }
+
+private:
+    __m512i q;
+};
+#endif
+
+// best and second best distance of one query
+struct BestTwo
+{
+    int best = INT_MAX, secondBest = INT_MAX, bestIdx = -1;
+
+    void add(int d, int idx)
+    {
+        if (d < best) // on equal distances the first reference wins, as in OpenCV
+        {
+            secondBest = best;
+            best = d;
+            bestIdx = idx;
+        }
+        else if (d < secondBest)
+        {
+            secondBest = d;
+        }
+    }
+};
+
+// matches the given query rows against all reference rows, or only against their candidates if given;
+// queries failing the ratio test are marked by trainIdx -1
+template <class Kernel>
+void matchRows(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets *candidates, const cv::Range &rows,
+               double minDescDistRatio, cv::DMatch *out)
+{
+    const uchar *refData = descRef.data;
+    size_t refStep = descRef.step;
+    int nRef = descRef.rows;
+
+    for (int q = rows.start; q < rows.end; ++q)
+    {
+        Kernel distance(descSource.ptr<uchar>(q), descSource.cols);
+        BestTwo nn;
+        if (candidates)
+        {
+            for (const int *it = candidates->begin(q); it != candidates->end(q); ++it) nn.add(distance(refData + *it * refStep), *it);
+        }
+        else
+        {
+            for (int t = 0; t < nRef; ++t) nn.add(distance(refData + t * refStep), t);
+        }
+
+        bool bAccept = nn.secondBest != INT_MAX && nn.best < minDescDistRatio * (float)nn.secondBest;
+        out[q] = cv::DMatch(q, bAccept ? nn.bestIdx : -1, (float)nn.best);
+    }
+}
+
+typedef void (*MatchRowsFn)(const cv::Mat &, const cv::Mat &, const IndexBuckets *, const cv::Range &, double, cv::DMatch *);
+
+#ifdef HAMMING_SIMD_DISPATCH
+// flatten inlines the kernel into the row loop, which is then compiled for the instruction set of the kernel
+template <class Kernel>
+TARGET_AVX2 __attribute__((flatten)) void matchRowsAvx2(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets *candidates,
+                                                        const cv::Range &rows, double minDescDistRatio, cv::DMatch *out)
+{
+    matchRows<Kernel>(descSource, descRef, candidates, rows, minDescDistRatio, out);
+}
+
+template <class Kernel>
+TARGET_AVX512 __attribute__((flatten)) void matchRowsAvx512(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets *candidates,
+                                                            const cv::Range &rows, double minDescDistRatio, cv::DMatch *out)
+{
+    matchRows<Kernel>(descSource, descRef, candidates, rows, minDescDistRatio, out);
+}
+#endif
+
+// row matchers for 32 and 64 byte rows, for the best instruction set of the CPU
+struct RowMatchers
+{
+    MatchRowsFn rows32, rows64;
+    const char *name;
+};
+
+RowMatchers selectRowMatchers()
+{
+#ifdef HAMMING_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx512vl"))
+    {
+        RowMatchers avx512 = { matchRowsAvx512<Avx512Kernel32>, matchRowsAvx512<Avx512Kernel64>, "AVX-512" };
+        return avx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        RowMatchers avx2 = { matchRowsAvx2<Avx2Kernel<32>>, matchRowsAvx2<Avx2Kernel<64>>, "AVX2" };
+        return avx2;
+    }
+#endif
+    RowMatchers scalar = { matchRows<FixedScalarKernel<32>>, matchRows<FixedScalarKernel<64>>, "scalar" };
+    return scalar;
+}
+
+const RowMatchers &rowMatchers()
+{
+    static const RowMatchers matchers = selectRowMatchers();
+    return matchers;
+}
+
+void matchRowsParallel(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets *candidates,
+                       std::vector<cv::DMatch> &matches, double minDescDistRatio)
+{
+    matches.clear();
+    if (descSource.empty() || descRef.empty()) return;
+    if (descSource.type() != CV_8U || descRef.type() != CV_8U || descSource.cols != descRef.cols)
+        throw invalid_argument("matchHammingKnnRatio: descriptors must be binary (CV_8U) rows of equal length");
+
+    matches.resize(descSource.rows);
+    cv::DMatch *out = matches.data();
+    int len = descSource.cols;
+    MatchRowsFn rowsFn = len == 32 ? rowMatchers().rows32 : len == 64 ? rowMatchers().rows64 : matchRows<ScalarKernel>;
+    cv::parallel_for_(cv::Range(0, descSource.rows), [&](const cv::Range &rows)
+    {
+        rowsFn(descSource, descRef, candidates, rows, minDescDistRatio, out);
+    });
+
+    // compact in query order
+    matches.erase(remove_if(matches.begin(), matches.end(), [](const cv::DMatch &m) { return m.trainIdx < 0; }), matches.end());
+}
+
+} // namespace
+
+const char *hammingMatcherKernel()
+{
+    return rowMatchers().name;
+}
+
+void matchHammingKnnRatio(const cv::Mat &descSource, const cv::Mat &descRef, std::vector<cv::DMatch> &matches, double minDescDistRatio)
+{
+    matchRowsParallel(descSource, descRef, nullptr, matches, minDescDistRatio);
+}
+
+void matchHammingKnnRatio(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets &candidates,
+                          std::vector<cv::DMatch> &matches, double minDescDistRatio)
+{
+    if (candidates.size() != (size_t)descSource.rows)
+        throw invalid_argument("matchHammingKnnRatio: need one candidate list per source descriptor");
+    matchRowsParallel(descSource, descRef, &candidates, matches, minDescDistRatio);
+}
@@ -0,0 +1,28 @@
+
+#ifndef hammingMatcher_hpp
+#define hammingMatcher_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+#include "dataStructures.h"
+
+// Brute-force 2-nearest-neighbor matching of binary descriptors (CV_8U rows, e.g. BRIEF, ORB, BRISK, FREAK) by
+// Hamming distance with the descriptor distance ratio test applied on the fly: per query only the best and the
+// second best distance are kept, and a match is stored if best < minDescDistRatio * secondBest. Gives the same
+// matches in the same order as knnMatch() with k=2 of a BFMatcher(NORM_HAMMING) followed by the ratio test.
+// Query rows are matched in parallel. Rows of 32 and 64 bytes use AVX-512 (VPOPCNTDQ) or AVX2 popcount kernels if
+// the CPU supports them (detected at runtime, GCC and Clang on x86), other sizes and CPUs a portable scalar kernel.
+void matchHammingKnnRatio(const cv::Mat &descSource, const cv::Mat &descRef, std::vector<cv::DMatch> &matches,
+                          double minDescDistRatio = 0.8);
+
+// same as above, but descSource row i is only compared to the descRef rows listed in bucket i of candidates
+void matchHammingKnnRatio(const cv::Mat &descSource, const cv::Mat &descRef, const IndexBuckets &candidates,
+                          std::vector<cv::DMatch> &matches, double minDescDistRatio = 0.8);
+
+// instruction set of the kernel used for rows of 32 and 64 bytes on this CPU: "AVX-512", "AVX2" or "scalar"
+const char *hammingMatcherKernel();
+
+#endif /* hammingMatcher_hpp */
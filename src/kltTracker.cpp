@@ -0,0 +1,87 @@
+#include <cmath>
+#include <stdexcept>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "kltTracker.hpp"
+
+using namespace std;
+
+KltTracker::KltTracker(int redetectInterval, int minTracks, float minDistance, cv::Size winSize, int maxLevel, float maxFbError)
+    : redetectInterval(redetectInterval), minTracks(minTracks), minDistance(minDistance), winSize(winSize), maxLevel(maxLevel),
+      maxFbError(maxFbError)
+{
+    if (redetectInterval < 1) throw invalid_argument("KltTracker: redetectInterval must be at least 1");
+}
+
+void KltTracker::buildPyramid(const cv::Mat &imgGray, std::vector<cv::Mat> &pyramid) const
+{
+    cv::buildOpticalFlowPyramid(imgGray, pyramid, winSize, maxLevel);
+}
+
+void KltTracker::track(const std::vector<cv::Mat> &pyramid, std::vector<cv::KeyPoint> &keypoints, std::vector<cv::DMatch> &matches)
+{
+    if (pyramid.empty()) throw invalid_argument("KltTracker: empty pyramid, see buildPyramid()");
+    keypoints.clear();
+    matches.clear();
+    imgSize = pyramid[0].size();
+    ++framesSinceDetection;
+    numTracked = 0;
+    if (refPts.empty()) return;
+
+    cv::calcOpticalFlowPyrLK(refPyramid, pyramid, refPts, pts, status, err, winSize, maxLevel);
+    if (maxFbError > 0)
+    {
+        // tracking back into the reference frame must return close to the start, otherwise the track has drifted
+        backPts = refPts;
+        cv::calcOpticalFlowPyrLK(pyramid, refPyramid, pts, backPts, backStatus, err, winSize, maxLevel,
+                                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
+    }
+
+    cv::Rect2f imgRect(0, 0, (float)imgSize.width, (float)imgSize.height);
+    for (size_t i = 0; i < refPts.size(); ++i)
+    {
+        if (!status[i] || !imgRect.contains(pts[i])) continue;
+        float fbError = 0;
+        if (maxFbError > 0)
+        {
+            if (!backStatus[i]) continue;
+            cv::Point2f d = backPts[i] - refPts[i];
+            fbError = sqrt(d.x * d.x + d.y * d.y);
+            if (fbError > maxFbError) continue;
+        }
+
+        cv::KeyPoint kpt = refKeypoints[i];
+        kpt.pt = pts[i];
+        matches.push_back(cv::DMatch((int)i, (int)keypoints.size(), fbError));
+        keypoints.push_back(kpt);
+    }
+    numTracked = (int)keypoints.size();
+}
+
+bool KltTracker::needsDetection() const
+{
+    return refPts.empty() || framesSinceDetection >= redetectInterval || numTracked < minTracks;
+}
+
+void KltTracker::addDetections(std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::KeyPoint> &detected)
+{
+    // tracked keypoints block a disc around them
+    cv::Mat freeMask(imgSize, CV_8U, cv::Scalar(255));
+    int radius = cvRound(minDistance);
+    for (auto &kpt : keypoints) cv::circle(freeMask, kpt.pt, radius, cv::Scalar(0), -1);
+
+    for (auto &kpt : detected)
+    {
+        cv::Point pt = kpt.pt;
+        if (pt.x >= 0 && pt.y >= 0 && pt.x < freeMask.cols && pt.y < freeMask.rows && freeMask.at<uchar>(pt)) keypoints.push_back(kpt);
+    }
+    framesSinceDetection = 0;
+}
+
+void KltTracker::setReference(const std::vector<cv::Mat> &pyramid, const std::vector<cv::KeyPoint> &keypoints)
+{
+    refKeypoints = keypoints;
+    cv::KeyPoint::convert(refKeypoints, refPts);
+    refPyramid = pyramid;
+}
@@ -0,0 +1,56 @@
+
+#ifndef kltTracker_hpp
+#define kltTracker_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+// Keypoint correspondences by pyramidal Lucas-Kanade optical flow instead of descriptor matching. The keypoints of
+// each frame become the reference which is tracked into the next frame; a keypoint detector is only needed on the
+// first frame, every redetectInterval frames or when fewer than minTracks keypoints could be tracked. The image
+// pyramid of a frame is built once by buildPyramid() and kept with the frame; the tracker only holds on to the
+// reference frame's pyramid (sharing its data) until the next frame has been tracked.
+// Per frame, call buildPyramid(), track(), then addDetections() if needsDetection(), then setReference().
+class KltTracker
+{
+public:
+    KltTracker(int redetectInterval = 5, int minTracks = 300, float minDistance = 5.0f, cv::Size winSize = cv::Size(21, 21),
+               int maxLevel = 3, float maxFbError = 1.0f);
+
+    // pyramid of a grayscale image with the window size and no. of levels used for tracking
+    void buildPyramid(const cv::Mat &imgGray, std::vector<cv::Mat> &pyramid) const;
+
+    // tracks the reference keypoints into the image of pyramid: keypoints receives the tracked ones (with their new position) and
+    // matches relates them to the reference (queryIdx: reference keypoint, trainIdx: keypoint, distance: flow error)
+    void track(const std::vector<cv::Mat> &pyramid, std::vector<cv::KeyPoint> &keypoints, std::vector<cv::DMatch> &matches);
+
+    bool needsDetection() const;
+
+    // appends the detected keypoints which are not within minDistance of one of the tracked keypoints
+    void addDetections(std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::KeyPoint> &detected);
+
+    // keypoints and pyramid of the frame last passed to track() are the reference for the next frame
+    void setReference(const std::vector<cv::Mat> &pyramid, const std::vector<cv::KeyPoint> &keypoints);
+
+private:
+    int redetectInterval, minTracks;
+    float minDistance;
+    cv::Size winSize;
+    int maxLevel;
+    float maxFbError; // max. distance [px] between a reference point and its forward-backward tracked position, <= 0 disables the check
+
+    std::vector<cv::KeyPoint> refKeypoints;
+    std::vector<cv::Point2f> refPts;
+    std::vector<cv::Mat> refPyramid; // headers only, the data belongs to the reference frame
+    cv::Size imgSize;
+    int framesSinceDetection = 0, numTracked = 0;
+
+    // buffers reused across frames
+    std::vector<cv::Point2f> pts, backPts;
+    std::vector<uchar> status, backStatus;
+    std::vector<float> err;
+};
+
+#endif /* kltTracker_hpp */
@@ -1,68 +1,202 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <iostream>
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "lidarData.hpp"
+#include "mappedFile.hpp"
 
 
 using namespace std;
 
+const cv::Point LidarCameraCalibration::behindCamera(INT_MIN, INT_MIN);
+
+LidarCameraCalibration::LidarCameraCalibration(cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT)
+{
+    // fused in double precision, then applied in float like the point coordinates
+    cv::Mat fused = P_rect_xx * R_rect_xx * RT;
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            P[r][c] = (float)fused.at<double>(r, c);
+}
+
+void LidarCameraCalibration::projectToImage(const PointCloud &lidarPoints, std::vector<cv::Point> &imgPoints) const
+{
+    imgPoints.resize(lidarPoints.size());
+
+    const float minDepth = 1e-3f; // [m] points closer to the camera plane (or behind it) are culled
+    const float maxCoord = 1e6f;  // [px] projections are clamped to +-maxCoord, so the conversion to int is defined
+    const float p00 = P[0][0], p01 = P[0][1], p02 = P[0][2], p03 = P[0][3];
+    const float p10 = P[1][0], p11 = P[1][1], p12 = P[1][2], p13 = P[1][3];
+    const float p20 = P[2][0], p21 = P[2][1], p22 = P[2][2], p23 = P[2][3];
+    const float *px = lidarPoints.x.data(), *py = lidarPoints.y.data(), *pz = lidarPoints.z.data();
+    cv::Point *dst = imgPoints.data();
+    const size_t n = lidarPoints.size();
+    size_t i = 0;
+
+#if CV_SIMD
+    // the compiler does not vectorize the culling and the conversion to int at -O2, so the loop is written with
+    // OpenCV's universal intrinsics; culling is a lane select, x and y are stored interleaved into the cv::Points
+    const size_t nLanes = cv::v_float32::nlanes;
+    const cv::v_float32 vp00 = cv::vx_setall_f32(p00), vp01 = cv::vx_setall_f32(p01), vp02 = cv::vx_setall_f32(p02), vp03 = cv::vx_setall_f32(p03);
+    const cv::v_float32 vp10 = cv::vx_setall_f32(p10), vp11 = cv::vx_setall_f32(p11), vp12 = cv::vx_setall_f32(p12), vp13 = cv::vx_setall_f32(p13);
+    const cv::v_float32 vp20 = cv::vx_setall_f32(p20), vp21 = cv::vx_setall_f32(p21), vp22 = cv::vx_setall_f32(p22), vp23 = cv::vx_setall_f32(p23);
+    const cv::v_float32 vMinDepth = cv::vx_setall_f32(minDepth), vOne = cv::vx_setall_f32(1.0f);
+    const cv::v_float32 vMinCoord = cv::vx_setall_f32(-maxCoord), vMaxCoord = cv::vx_setall_f32(maxCoord);
+    const cv::v_int32 vBehindX = cv::vx_setall_s32(behindCamera.x), vBehindY = cv::vx_setall_s32(behindCamera.y);
+    for (; i + nLanes <= n; i += nLanes)
+    {
+        cv::v_float32 x = cv::vx_load(px + i), y = cv::vx_load(py + i), z = cv::vx_load(pz + i);
+        cv::v_float32 u = vp00 * x + vp01 * y + vp02 * z + vp03;
+        cv::v_float32 v = vp10 * x + vp11 * y + vp12 * z + vp13;
+        cv::v_float32 w = vp20 * x + vp21 * y + vp22 * z + vp23;
+        cv::v_float32 inFront = w > vMinDepth;
+        cv::v_float32 wSafe = cv::v_select(inFront, w, vOne);
+        cv::v_int32 uImg = cv::v_trunc(cv::v_min(cv::v_max(u / wSafe, vMinCoord), vMaxCoord));
+        cv::v_int32 vImg = cv::v_trunc(cv::v_min(cv::v_max(v / wSafe, vMinCoord), vMaxCoord));
+        cv::v_int32 inFrontMask = cv::v_reinterpret_as_s32(inFront);
+        cv::v_store_interleave(&dst[i].x, cv::v_select(inFrontMask, uImg, vBehindX), cv::v_select(inFrontMask, vImg, vBehindY));
+    }
+    cv::vx_cleanup();
+#endif
+
+    // remainder, same arithmetic as the vector loop
+    for (; i < n; ++i)
+    {
+        float x = px[i], y = py[i], z = pz[i];
+        float u = p00 * x + p01 * y + p02 * z + p03;
+        float v = p10 * x + p11 * y + p12 * z + p13;
+        float w = p20 * x + p21 * y + p22 * z + p23;
+        bool bInFront = w > minDepth;
+        float wSafe = bInFront ? w : 1.0f;
+        float uImg = min(max(u / wSafe, -maxCoord), maxCoord);
+        float vImg = min(max(v / wSafe, -maxCoord), maxCoord);
+        dst[i].x = bInFront ? (int)uImg : behindCamera.x;
+        dst[i].y = bInFront ? (int)vImg : behindCamera.y;
+    }
+}
+
+void VoxelGridFilter::filter(const PointCloud &input, PointCloud &output)
+{
+    output.clear();
+    voxels.clear();
+
+    const float invLeafSize = 1.0f / leafSize;
+    const int64_t offset = 1 << 20; // voxel coordinates are packed into 21 bits each, i.e. +-1e6 voxels per axis
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        int64_t vx = (int64_t)floor(input.x[i] * invLeafSize) + offset;
+        int64_t vy = (int64_t)floor(input.y[i] * invLeafSize) + offset;
+        int64_t vz = (int64_t)floor(input.z[i] * invLeafSize) + offset;
+        uint64_t key = ((uint64_t)(vx & 0x1FFFFF) << 42) | ((uint64_t)(vy & 0x1FFFFF) << 21) | (uint64_t)(vz & 0x1FFFFF);
+
+        auto inserted = voxels.insert(std::make_pair(key, (int)output.size()));
+        if (inserted.second)
+        {
+            output.push_back(input, i);
+        }
+        else
+        {
+            // keep the closest point of the voxel
+            int j = inserted.first->second;
+            if (input.x[i] < output.x[j])
+            {
+                output.x[j] = input.x[i]; output.y[j] = input.y[i]; output.z[j] = input.z[i]; output.r[j] = input.r[i];
+            }
+        }
+    }
+}
+
 // remove Lidar points based on min. and max distance in X, Y and Z
-void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+void cropLidarPoints(PointCloud &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
 {
-    std::vector<LidarPoint> newLidarPts; 
-    for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
+    // compact the surviving points in place
+    size_t newSize = 0;
+    for(size_t i=0; i<lidarPoints.size(); ++i) {
         
-       if( (*it).x>=minX && (*it).x<=maxX && (*it).z>=minZ && (*it).z<=maxZ && (*it).z<=0.0 && abs((*it).y)<=maxY && (*it).r>=minR )  // Check if Lidar point is outside of boundaries
+       float x = lidarPoints.x[i], y = lidarPoints.y[i], z = lidarPoints.z[i], r = lidarPoints.r[i];
+       if( x>=minX && x<=maxX && z>=minZ && z<=maxZ && z<=0.0f && abs(y)<=maxY && r>=minR )  // Check if Lidar point is outside of boundaries
        {
-           newLidarPts.push_back(*it);
+           lidarPoints.x[newSize] = x; lidarPoints.y[newSize] = y; lidarPoints.z[newSize] = z; lidarPoints.r[newSize] = r;
+           ++newSize;
        }
     }
 
-    lidarPoints = newLidarPts;
+    lidarPoints.resize(newSize);
 }
 
 
 
 // Load Lidar points from a given location and store them in a vector
-void loadLidarFromFile(vector<LidarPoint> &lidarPoints, string filename)
+// every point of a KITTI velodyne scan is stored as four float32 values x, y, z and r
+static const float *mapLidarFile(MappedFile &file, const string &filename, size_t &num)
+{
+    num = 0;
+    if (file.data() == nullptr)
+    {
+        cerr << "cannot read Lidar file " << filename << endl;
+        return nullptr;
+    }
+    if (file.size() % (4 * sizeof(float)) != 0)
+    {
+        cerr << "truncated Lidar file " << filename << endl;
+        return nullptr;
+    }
+    num = file.size() / (4 * sizeof(float));
+    return (const float *)file.data();
+}
+
+bool loadLidarFromFile(PointCloud &lidarPoints, string filename)
+{
+    MappedFile file(filename);
+    size_t num;
+    const float *data = mapLidarFile(file, filename, num);
+    if (data == nullptr) return false;
+
+    // de-interleave into the coordinate arrays
+    size_t offset = lidarPoints.size();
+    lidarPoints.resize(offset + num);
+    for (size_t i = 0; i < num; i++, data += 4) {
+        lidarPoints.x[offset + i] = data[0]; lidarPoints.y[offset + i] = data[1]; lidarPoints.z[offset + i] = data[2]; lidarPoints.r[offset + i] = data[3];
+    }
+    return true;
+}
+
+// load only the points which cropLidarPoints() would keep, in a single pass over the mapped file; the buffer is
+// overwritten and keeps its capacity, so it can be reused across frames without reallocation
+bool loadLidarFromFile(PointCloud &lidarPoints, string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
 {
-    // allocate 4 MB buffer (only ~130*4*4 KB are needed)
-    unsigned long num = 1000000;
-    float *data = (float*)malloc(num*sizeof(float));
-    
-    // pointers
-    float *px = data+0;
-    float *py = data+1;
-    float *pz = data+2;
-    float *pr = data+3;
-    
-    // load point cloud
-    FILE *stream;
-    stream = fopen (filename.c_str(),"rb");
-    num = fread(data,sizeof(float),num,stream)/4;
- 
-    for (int32_t i=0; i<num; i++) {
-        LidarPoint lpt;
-        lpt.x = *px; lpt.y = *py; lpt.z = *pz; lpt.r = *pr;
-        lidarPoints.push_back(lpt);
-        px+=4; py+=4; pz+=4; pr+=4;
-    }
-    fclose(stream);
+    MappedFile file(filename);
+    size_t num;
+    const float *data = mapLidarFile(file, filename, num);
+    lidarPoints.clear();
+    if (data == nullptr) return false;
+
+    lidarPoints.reserve(num);
+    for (size_t i = 0; i < num; i++, data += 4) {
+        float x = data[0], y = data[1], z = data[2], r = data[3];
+        if (x >= minX && x <= maxX && z >= minZ && z <= maxZ && z <= 0.0f && abs(y) <= maxY && r >= minR)
+        {
+            lidarPoints.push_back(x, y, z, r);
+        }
+    }
+    return true;
 }
 
 
-void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait)
+void showLidarTopview(const PointCloudView &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait)
 {
     // create topview image
     cv::Mat topviewImg(imageSize, CV_8UC3, cv::Scalar(0, 0, 0));
 
     // plot Lidar points into image
-    for (auto it = lidarPoints.begin(); it != lidarPoints.end(); ++it)
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
     {
-        float xw = (*it).x; // world position in m with x facing forward from sensor
-        float yw = (*it).y; // world position in m with y facing left from sensor
+        float xw = lidarPoints.x(i); // world position in m with x facing forward from sensor
+        float yw = lidarPoints.y(i); // world position in m with y facing left from sensor
 
         int y = (-xw * imageSize.height / worldSize.height) + imageSize.height;
         int x = (-yw * imageSize.height / worldSize.height) + imageSize.width / 2;
@@ -89,7 +223,16 @@ void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize,
     }
 }
 
-void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg)
+void showLidarImgOverlay(cv::Mat &img, const PointCloud &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg)
+{
+    LidarCameraCalibration calibration(P_rect_xx, R_rect_xx, RT);
+    std::vector<cv::Point> lidarImgPoints;
+    calibration.projectToImage(lidarPoints, lidarImgPoints);
+    showLidarImgOverlay(img, lidarPoints, lidarImgPoints, extVisImg);
+}
+
+// overlay Lidar points whose image coordinates have already been computed
+void showLidarImgOverlay(cv::Mat &img, const PointCloud &lidarPoints, std::vector<cv::Point> &lidarImgPoints, cv::Mat *extVisImg)
 {
     // init image for visualization
     cv::Mat visImg; 
@@ -105,31 +248,21 @@ void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv:
 
     // find max. x-value
     double maxVal = 0.0; 
-    for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it)
+    for(size_t i=0; i<lidarPoints.size(); ++i)
     {
-        maxVal = maxVal<it->x ? it->x : maxVal;
+        maxVal = maxVal<lidarPoints.x[i] ? lidarPoints.x[i] : maxVal;
     }
 
-    cv::Mat X(4,1,cv::DataType<double>::type);
-    cv::Mat Y(3,1,cv::DataType<double>::type);
-    for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
+    for(size_t i=0; i<lidarPoints.size(); ++i) {
 		
-            X.at<double>(0, 0) = it->x;
-            X.at<double>(1, 0) = it->y;
-            X.at<double>(2, 0) = it->z;
-            X.at<double>(3, 0) = 1;
-
-            Y = P_rect_xx * R_rect_xx * RT * X;
-            cv::Point pt;
-
-            pt.x = Y.at<double>(0, 0) / Y.at<double>(2, 0); 
-            pt.y = Y.at<double>(1, 0) / Y.at<double>(2, 0); 
+            cv::Point pt = lidarImgPoints[i];
+            if (pt == LidarCameraCalibration::behindCamera) continue;
 
-            float val = it->x;
+            float val = lidarPoints.x[i];
             int red = min(255, (int)(255 * abs((val - maxVal) / maxVal)));
             int green = min(255, (int)(255 * (1 - abs((val - maxVal) / maxVal))));
 			int blue = 0;
-			/*if (!(it->z<-0.92 || it->z>-0.9)) // highlight anomaly in frame 6 & 7
+			/*if (!(lidarPoints.z[i]<-0.92 || lidarPoints.z[i]>-0.9)) // highlight anomaly in frame 6 & 7
 			{
 				blue=255;
 			}*/
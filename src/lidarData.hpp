@@ -5,12 +5,48 @@
 #include <stdio.h>
 #include <fstream>
 #include <string>
+#include <unordered_map>
+#include <cstdint>
 
 #include "dataStructures.h"
 
-void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
-void loadLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename);
+// Lidar-to-camera calibration with the projection P_rect_xx * R_rect_xx * RT fused into a single 3x4 matrix
+class LidarCameraCalibration
+{
+public:
+    LidarCameraCalibration(cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
 
-void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
-void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg=nullptr);
+    // projects all points into the image in one pass; points behind (or within 1 mm of) the camera plane are set to
+    // behindCamera, the others are clamped to +-1e6 pixels
+    void projectToImage(const PointCloud &lidarPoints, std::vector<cv::Point> &imgPoints) const;
+
+    static const cv::Point behindCamera;
+
+private:
+    float P[3][4]; // fused projection matrix
+};
+
+// Hash-based voxel-grid downsampling which keeps the point with the smallest x (closest to the sensor) per voxel,
+// so distance estimates based on the closest points remain valid. The hash map is reused across calls.
+class VoxelGridFilter
+{
+public:
+    explicit VoxelGridFilter(float leafSize) : leafSize(leafSize) {}
+
+    // output points appear in the order in which their voxels are first seen in the input
+    void filter(const PointCloud &input, PointCloud &output);
+
+private:
+    float leafSize; // voxel edge length in [m]
+    std::unordered_map<uint64_t, int> voxels; // voxel key -> index of its point in the output
+};
+
+void cropLidarPoints(PointCloud &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+// both return false (and leave no points of the file) if it cannot be read or is truncated
+bool loadLidarFromFile(PointCloud &lidarPoints, std::string filename);
+bool loadLidarFromFile(PointCloud &lidarPoints, std::string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+
+void showLidarTopview(const PointCloudView &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
+void showLidarImgOverlay(cv::Mat &img, const PointCloud &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg=nullptr);
+void showLidarImgOverlay(cv::Mat &img, const PointCloud &lidarPoints, std::vector<cv::Point> &lidarImgPoints, cv::Mat *extVisImg=nullptr);
 #endif /* lidarData_hpp */
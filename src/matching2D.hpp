@@ -19,7 +19,25 @@
 
 #include "dataStructures.h"
 
+enum class DetectorType { SHITOMASI, HARRIS, HARRIS_GFT, FAST, BRISK, ORB, AKAZE, SIFT };
+enum class DescriptorType { BRISK, BRIEF, ORB, FREAK, AKAZE, SIFT };
+enum class MatcherType { MAT_BF, MAT_FLANN };
+enum class SelectorType { SEL_NN, SEL_KNN };
 
+// parse configuration names, throw std::invalid_argument for unknown names
+DetectorType parseDetectorType(const std::string &name);
+DescriptorType parseDescriptorType(const std::string &name);
+MatcherType parseMatcherType(const std::string &name);
+SelectorType parseSelectorType(const std::string &name);
+
+cv::Ptr<cv::FeatureDetector> createDetector(DetectorType detectorType);
+cv::Ptr<cv::DescriptorExtractor> createDescriptorExtractor(DescriptorType descriptorType);
+cv::Ptr<cv::DescriptorMatcher> createMatcher(MatcherType matcherType, bool bBinaryDescriptors, SelectorType selectorType);
+void selectMatches(cv::DescriptorMatcher &matcher, const cv::Mat &descSource, const cv::Mat *descRef, std::vector<cv::DMatch> &matches,
+                   SelectorType selectorType, std::vector<std::vector<cv::DMatch>> &knn_matches);
+
+
+void cornernessHarris(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false);
 void detKeypointsHarris(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false);
 void detKeypointsHarrisWithGoodFeaturesToTrack(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis = false);
 void detKeypointsShiTomasi(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false);
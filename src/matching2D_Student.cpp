@@ -1,94 +1,150 @@
 #include <numeric>
+#include <stdexcept>
 #include "matching2D.hpp"
+#include "hammingMatcher.hpp"
 
 using namespace std;
 
-// Find best matches for keypoints in two camera images based on several matching methods
-void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::KeyPoint> &kPtsRef, cv::Mat &descSource, cv::Mat &descRef,
-                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType)
+DetectorType parseDetectorType(const std::string &name)
 {
-    // configure matcher
-    bool crossCheck = true;
-	if (selectorType == "SEL_KNN") crossCheck = false; // crossCheck not supported for kNN matching in OpenCV
-    cv::Ptr<cv::DescriptorMatcher> matcher;
+    static const char *names[] = { "SHITOMASI", "HARRIS", "HARRIS_GFT", "FAST", "BRISK", "ORB", "AKAZE", "SIFT" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i)
+    {
+        if (name == names[i]) return (DetectorType)i;
+    }
+    throw invalid_argument("unknown detector type " + name);
+}
 
-    if (matcherType.compare("MAT_BF") == 0)
+DescriptorType parseDescriptorType(const std::string &name)
+{
+    static const char *names[] = { "BRISK", "BRIEF", "ORB", "FREAK", "AKAZE", "SIFT" };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i)
     {
-        int normType = descriptorType=="DES_BINARY"? cv::NORM_HAMMING : cv::NORM_L2;
-        matcher = cv::BFMatcher::create(normType, crossCheck);
+        if (name == names[i]) return (DescriptorType)i;
     }
-    else if (matcherType.compare("MAT_FLANN") == 0)
+    throw invalid_argument("unknown descriptor type " + name);
+}
+
+MatcherType parseMatcherType(const std::string &name)
+{
+    if (name == "MAT_BF") return MatcherType::MAT_BF;
+    if (name == "MAT_FLANN") return MatcherType::MAT_FLANN;
+    throw invalid_argument("unknown matcher type " + name);
+}
+
+SelectorType parseSelectorType(const std::string &name)
+{
+    if (name == "SEL_NN") return SelectorType::SEL_NN;
+    if (name == "SEL_KNN") return SelectorType::SEL_KNN;
+    throw invalid_argument("unknown selector type " + name);
+}
+
+// create the matcher; binary descriptors are compared by Hamming distance, all others by L2 norm
+cv::Ptr<cv::DescriptorMatcher> createMatcher(MatcherType matcherType, bool bBinaryDescriptors, SelectorType selectorType)
+{
+    // configure matcher
+    bool crossCheck = true;
+	if (selectorType == SelectorType::SEL_KNN) crossCheck = false; // crossCheck not supported for kNN matching in OpenCV
+
+    if (matcherType == MatcherType::MAT_FLANN)
     {
-		if (descSource.type() != CV_32F)
+		if (bBinaryDescriptors)
 		{
-			// OpenCV bug workaround : convert binary descriptors to floating point due to a bug in current OpenCV implementation
-			descSource.convertTo(descSource, CV_32F);
-			descRef.convertTo(descRef, CV_32F);
+			// multi-probe LSH works on the binary descriptors directly (Hamming distance), no conversion to float needed
+			int tableNumber = 12;     // no. of hash tables
+			int keySize = 20;         // no. of bits per hash key
+			int multiProbeLevel = 2;  // also probe neighboring buckets up to this bit distance
+			return cv::makePtr<cv::FlannBasedMatcher>(cv::makePtr<cv::flann::LshIndexParams>(tableNumber, keySize, multiProbeLevel));
 		}
-		matcher = cv::DescriptorMatcher::create(cv::DescriptorMatcher::FLANNBASED);
+		return cv::DescriptorMatcher::create(cv::DescriptorMatcher::FLANNBASED);
     }
+    int normType = bBinaryDescriptors ? cv::NORM_HAMMING : cv::NORM_L2;
+    return cv::BFMatcher::create(normType, crossCheck);
+}
 
+// match descriptors with a matcher created by createMatcher(); without descRef, the descriptors the matcher has been
+// trained on are used as reference. knn_matches is only used as a buffer
+void selectMatches(cv::DescriptorMatcher &matcher, const cv::Mat &descSource, const cv::Mat *descRef, std::vector<cv::DMatch> &matches,
+                   SelectorType selectorType, std::vector<std::vector<cv::DMatch>> &knn_matches)
+{
     // perform matching task
-    if (selectorType.compare("SEL_NN") == 0)
+    if (selectorType == SelectorType::SEL_NN)
     { // nearest neighbor (best match)
 
-        matcher->match(descSource, descRef, matches); // Finds the best match for each descriptor in desc1
+        if (descRef) matcher.match(descSource, *descRef, matches); // Finds the best match for each descriptor in desc1
+        else matcher.match(descSource, matches);
     }
-    else if (selectorType.compare("SEL_KNN") == 0)
+    else if (selectorType == SelectorType::SEL_KNN)
     { // k nearest neighbors (k=2)
 
 		// implement k-nearest-neighbor matching
-		vector<vector<cv::DMatch>> knn_matches;
-		
-		matcher->knnMatch(descSource, descRef, knn_matches, 2); // finds the 2 best matches
+		if (descRef) matcher.knnMatch(descSource, *descRef, knn_matches, 2); // finds the 2 best matches
+		else matcher.knnMatch(descSource, knn_matches, 2);
 		
 		// filter matches using descriptor distance ratio test
+		// (approximate matchers may find less than 2 neighbors, such matches cannot be tested and are dropped)
 		double minDescDistRatio = 0.8;
 		for (auto it = knn_matches.begin(); it != knn_matches.end(); ++it)
 		{
-			if ((*it)[0].distance < minDescDistRatio * (*it)[1].distance)
+			if (it->size() >= 2 && (*it)[0].distance < minDescDistRatio * (*it)[1].distance)
 			{
 				matches.push_back((*it)[0]);
 			}
 		}
-		cout << "# keypoints removed = " << knn_matches.size() - matches.size() << endl;
     }
 }
 
-// Use one of several types of state-of-art descriptors to uniquely identify keypoints
-void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, string descriptorType)
+// Find best matches for keypoints in two camera images based on several matching methods
+void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::KeyPoint> &kPtsRef, cv::Mat &descSource, cv::Mat &descRef,
+                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType)
 {
-    // select appropriate descriptor
-    cv::Ptr<cv::DescriptorExtractor> extractor;
-    if (descriptorType.compare("BRISK") == 0)
+    MatcherType matcher_type = parseMatcherType(matcherType);
+    SelectorType selector_type = parseSelectorType(selectorType);
+    if (matcher_type == MatcherType::MAT_BF && selector_type == SelectorType::SEL_KNN && descriptorType == "DES_BINARY")
     {
+        matchHammingKnnRatio(descSource, descRef, matches);
+        cout << "# keypoints removed = " << descSource.rows - matches.size() << endl;
+        return;
+    }
 
+    cv::Ptr<cv::DescriptorMatcher> matcher = createMatcher(matcher_type, descriptorType == "DES_BINARY", selector_type);
+    vector<vector<cv::DMatch>> knn_matches;
+    selectMatches(*matcher, descSource, &descRef, matches, selector_type, knn_matches);
+    if (selector_type == SelectorType::SEL_KNN) cout << "# keypoints removed = " << knn_matches.size() - matches.size() << endl;
+}
+
+// create one of several types of state-of-art descriptors
+cv::Ptr<cv::DescriptorExtractor> createDescriptorExtractor(DescriptorType descriptorType)
+{
+    // select appropriate descriptor
+    switch (descriptorType)
+    {
+    case DescriptorType::BRISK:
+    {
         int threshold = 30;        // FAST/AGAST detection threshold score.
         int octaves = 3;           // detection octaves (use 0 to do single scale)
         float patternScale = 1.0f; // apply this scale to the pattern used for sampling the neighbourhood of a keypoint.
 
-        extractor = cv::BRISK::create(threshold, octaves, patternScale);
+        return cv::BRISK::create(threshold, octaves, patternScale);
     }
-	else if (descriptorType.compare("BRIEF") == 0)
-	{
-		extractor = cv::xfeatures2d::BriefDescriptorExtractor::create();
-	}
-    else if (descriptorType.compare("ORB") == 0)
-    {
-		extractor = cv::ORB::create();
+    case DescriptorType::BRIEF:
+		return cv::xfeatures2d::BriefDescriptorExtractor::create();
+    case DescriptorType::ORB:
+		return cv::ORB::create();
+    case DescriptorType::FREAK:
+		return cv::xfeatures2d::FREAK::create();
+    case DescriptorType::AKAZE:
+		return cv::AKAZE::create();
+    case DescriptorType::SIFT:
+		return cv::xfeatures2d::SIFT::create();
     }
-	else if (descriptorType.compare("FREAK") == 0)
-	{
-		extractor = cv::xfeatures2d::FREAK::create();
-	}
-	else if (descriptorType.compare("AKAZE") == 0)
-	{
-		extractor = cv::AKAZE::create();
-	}
-	else if (descriptorType.compare("SIFT") == 0)
-	{
-		extractor = cv::xfeatures2d::SIFT::create();
-	}
+    return cv::Ptr<cv::DescriptorExtractor>();
+}
+
+// Use one of several types of state-of-art descriptors to uniquely identify keypoints
+void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, string descriptorType)
+{
+    cv::Ptr<cv::DescriptorExtractor> extractor = createDescriptorExtractor(parseDescriptorType(descriptorType));
 
     // perform feature description
     //double t = (double)cv::getTickCount();
@@ -163,52 +219,70 @@ void cornernessHarris(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis)
 	// locate local maxima in the Harris response matrix 
 	// and perform a non-maximum suppression (NMS) in a local neighborhood around 
 	// each maximum. 
-	vector<cv::KeyPoint> keypoint_candidates;
-	int x, y;
+	// candidates are collected with a row-major scan; their (truncated) responses are kept in an image in which
+	// suppressed candidates are cleared, so the NMS only needs to look at the neighborhood of each candidate
 	int nms_size = apertureSize;
-	for (x = 0; x < img.size().width; x++)
-		for (y = 0; y < img.size().height; y++)
+	int width = img.size().width, height = img.size().height;
+	cv::Mat candidate_responses = cv::Mat::zeros(height, width, CV_32SC1);
+	vector<cv::Point> row_major_candidates;
+	vector<int> column_start(width + 1, 0);
+	for (int y = 0; y < height; y++)
+	{
+		const float *dst_row = dst_norm.ptr<float>(y);
+		int *response_row = candidate_responses.ptr<int>(y);
+		for (int x = 0; x < width; x++)
 		{
-			int response = dst_norm.at<float>(y, x);
+			int response = dst_row[x];
 			if (response > minResponse)
 			{
-				keypoint_candidates.emplace_back();
-				cv::KeyPoint &kp = keypoint_candidates.back();
-				kp.pt.x = x;
-				kp.pt.y = y;
-				kp.size = nms_size;
-				kp.response = response;
+				response_row[x] = response;
+				row_major_candidates.push_back(cv::Point(x, y));
+				column_start[x + 1]++;
 			}
 		}
+	}
+
+	// the greedy NMS depends on the order of the candidates: column by column, top to bottom within a column
+	for (int x = 0; x < width; x++) column_start[x + 1] += column_start[x];
+	vector<cv::Point> keypoint_candidates(row_major_candidates.size());
+	for (auto &pt : row_major_candidates) keypoint_candidates[column_start[pt.x]++] = pt;
 
-	for (int idx = 0; idx < keypoint_candidates.size(); idx++)
+	// a candidate is kept if no later candidate closer than 2 * nms_size in x and y has an equal or higher response,
+	// and then suppresses all of them
+	int nms_dist = nms_size * 2 - 1;
+	for (auto &pt : keypoint_candidates)
 	{
-		auto &kp = keypoint_candidates[idx];
-		if (kp.response == 0) continue;
-		int idx2;
-		vector<int> to_be_removed;
-		for (idx2 = idx + 1; idx2 < keypoint_candidates.size(); idx2++)
+		int response = candidate_responses.at<int>(pt.y, pt.x);
+		if (response == 0) continue; // suppressed by a previous keypoint
+		int x2_max = min(pt.x + nms_dist, width - 1);
+		int y2_min = max(pt.y - nms_dist, 0), y2_max = min(pt.y + nms_dist, height - 1);
+		bool bMaximum = true;
+		for (int x2 = pt.x; x2 <= x2_max && bMaximum; x2++)
 		{
-			auto &kp2 = keypoint_candidates[idx2];
-			if (kp2.response == 0) continue;
-			if (kp2.pt.x - nms_size * 2 < kp.pt.x && kp2.pt.x + nms_size * 2 > kp.pt.x &&
-				kp2.pt.y - nms_size * 2 < kp.pt.y && kp2.pt.y + nms_size * 2 > kp.pt.y)
+			for (int y2 = (x2 == pt.x ? pt.y + 1 : y2_min); y2 <= y2_max; y2++)
 			{
-				if (kp.response > kp2.response)
-				{
-					to_be_removed.push_back(idx2);
-				}
-				else
+				if (candidate_responses.at<int>(y2, x2) >= response)
 				{
+					bMaximum = false;
 					break;
 				}
 			}
 		}
-		if (idx2 == keypoint_candidates.size())
+		if (!bMaximum) continue;
+
+		for (int x2 = pt.x; x2 <= x2_max; x2++)
 		{
-			for (auto i : to_be_removed) keypoint_candidates[i].response = 0;
-			keypoints.push_back(kp);
+			for (int y2 = (x2 == pt.x ? pt.y + 1 : y2_min); y2 <= y2_max; y2++)
+			{
+				candidate_responses.at<int>(y2, x2) = 0;
+			}
 		}
+		keypoints.emplace_back();
+		cv::KeyPoint &kp = keypoints.back();
+		kp.pt.x = pt.x;
+		kp.pt.y = pt.y;
+		kp.size = nms_size;
+		kp.response = response;
 	}
 
 	if (bVis)
@@ -233,30 +307,34 @@ void detKeypointsHarrisWithGoodFeaturesToTrack(vector<cv::KeyPoint> &keypoints,
 	detKeypointsShiTomasiOrHarris(keypoints, img, bVis, true);
 }
 
-void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, std::string detectorType, bool bVis)
+// create the detector for FAST, BRISK, ORB, AKAZE or SIFT; the classic corner detectors have no detector object
+cv::Ptr<cv::FeatureDetector> createDetector(DetectorType detectorType)
 {
-	cv::Ptr<cv::FeatureDetector> detector;
-	if (detectorType == "FAST")
+	switch (detectorType)
+	{
+	case DetectorType::FAST:
 	{
 		int nThreshold = 30; // intensity difference
 		bool bNMS = true; // non maximum suppression
-		detector = cv::FastFeatureDetector::create(nThreshold, bNMS, cv::FastFeatureDetector::TYPE_9_16);
+		return cv::FastFeatureDetector::create(nThreshold, bNMS, cv::FastFeatureDetector::TYPE_9_16);
 	}
-	else if (detectorType == "BRISK")
-	{
-		detector = cv::BRISK::create();
-	}
-	else if (detectorType == "ORB")
-	{
-		detector = cv::ORB::create(1000);
-	}
-	else if (detectorType == "AKAZE")
-	{
-		detector = cv::AKAZE::create();
-	} else if (detectorType == "SIFT")
-	{
-		detector = cv::xfeatures2d::SIFT::create();
+	case DetectorType::BRISK:
+		return cv::BRISK::create();
+	case DetectorType::ORB:
+		return cv::ORB::create(1000);
+	case DetectorType::AKAZE:
+		return cv::AKAZE::create();
+	case DetectorType::SIFT:
+		return cv::xfeatures2d::SIFT::create();
+	default:
+		return cv::Ptr<cv::FeatureDetector>();
 	}
+}
+
+void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, std::string detectorType, bool bVis)
+{
+	cv::Ptr<cv::FeatureDetector> detector = createDetector(parseDetectorType(detectorType));
+	if (!detector) throw invalid_argument(detectorType + " is not a modern detector");
 
 	//double t = (double)cv::getTickCount();
 	detector->detect(img, keypoints);
@@ -2,6 +2,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <memory>
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -12,22 +14,43 @@
 
 using namespace std;
 
-// detects objects in an image using the YOLO library and a set of pre-trained objects from the COCO database;
+// loads the class names, the neural network and the names of its output layers;
 // a set of 80 classes is listed in "coco.names" and pre-trained weights are stored in "yolov3.weights"
-void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
-                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+ObjectDetector::ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights)
 {
     // load class names from file
-    vector<string> classes;
     ifstream ifs(classesFile.c_str());
     string line;
     while (getline(ifs, line)) classes.push_back(line);
     
     // load neural network
-    cv::dnn::Net net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
+    net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
     net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
     net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
     
+    // Get names of output layers
+    vector<int> outLayers = net.getUnconnectedOutLayers(); // get  indices of  output layers, i.e.  layers with unconnected outputs
+    vector<cv::String> layersNames = net.getLayerNames(); // get  names of all layers in the network
+    
+    outputNames.resize(outLayers.size());
+    for (size_t i = 0; i < outLayers.size(); ++i) // Get the names of the output layers in names
+        outputNames[i] = layersNames[outLayers[i] - 1];
+}
+
+ObjectDetector &ObjectDetector::shared(std::string classesFile, std::string modelConfiguration, std::string modelWeights)
+{
+    static std::mutex instancesMutex;
+    static map<string, unique_ptr<ObjectDetector>> instances;
+
+    lock_guard<mutex> lock(instancesMutex);
+    unique_ptr<ObjectDetector> &instance = instances[classesFile + "|" + modelConfiguration + "|" + modelWeights];
+    if (!instance) instance.reset(new ObjectDetector(classesFile, modelConfiguration, modelWeights));
+    return *instance;
+}
+
+// detects objects in an image using the YOLO network loaded by the constructor
+void ObjectDetector::detect(const cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis)
+{
     // generate 4D blob from input image
     cv::Mat blob;
     vector<cv::Mat> netOutput;
@@ -38,19 +61,69 @@ void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThr
     bool crop = false;
     cv::dnn::blobFromImage(img, blob, scalefactor, size, mean, swapRB, crop);
     
-    // Get names of output layers
-    vector<cv::String> names;
-    vector<int> outLayers = net.getUnconnectedOutLayers(); // get  indices of  output layers, i.e.  layers with unconnected outputs
-    vector<cv::String> layersNames = net.getLayerNames(); // get  names of all layers in the network
-    
-    names.resize(outLayers.size());
-    for (size_t i = 0; i < outLayers.size(); ++i) // Get the names of the output layers in names
-        names[i] = layersNames[outLayers[i] - 1];
-    
     // invoke forward propagation through network
-    net.setInput(blob);
-    net.forward(netOutput, names);
+    {
+        lock_guard<mutex> lock(netMutex);
+        net.setInput(blob);
+        net.forward(netOutput, outputNames);
+    }
     
+    postprocess(img, netOutput, bBoxes, confThreshold, nmsThreshold, bVis);
+}
+
+// detects objects in several images with a single forward pass; the images are stacked into one 4D blob,
+// which makes better use of the matrix multiplications than one blob per frame (offline processing only,
+// as all images of the batch have to be available before the first result is produced)
+void ObjectDetector::detectBatch(const std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes, float confThreshold, float nmsThreshold, bool bVis)
+{
+    bBoxes.resize(imgs.size());
+    if (imgs.empty()) return;
+
+    // generate 4D blob from all input images
+    cv::Mat blob;
+    vector<cv::Mat> netOutput;
+    double scalefactor = 1/255.0;
+    cv::Size size = cv::Size(416, 416);
+    cv::Scalar mean = cv::Scalar(0,0,0);
+    bool swapRB = false;
+    bool crop = false;
+    cv::dnn::blobFromImages(imgs, blob, scalefactor, size, mean, swapRB, crop);
+
+    // invoke forward propagation through network
+    {
+        lock_guard<mutex> lock(netMutex);
+        net.setInput(blob);
+        net.forward(netOutput, outputNames);
+    }
+
+    // split each output layer into the per-image detections (no copy, only headers to the output data)
+    int batchSize = (int)imgs.size();
+    for (int n = 0; n < batchSize; ++n)
+    {
+        vector<cv::Mat> imgOutput;
+        for (size_t i = 0; i < netOutput.size(); ++i)
+        {
+            cv::Mat &out = netOutput[i];
+            int rows, cols;
+            if (out.dims == 3) // [batch, rows, cols]
+            {
+                rows = out.size[1];
+                cols = out.size[2];
+            }
+            else // [batch * rows, cols]
+            {
+                rows = out.rows / batchSize;
+                cols = out.cols;
+            }
+            imgOutput.push_back(cv::Mat(rows, cols, CV_32F, out.ptr<float>() + (size_t)n * rows * cols));
+        }
+        postprocess(imgs[n], imgOutput, bBoxes[n], confThreshold, nmsThreshold, bVis);
+    }
+}
+
+// converts the network output for one image into bounding boxes
+void ObjectDetector::postprocess(const cv::Mat& img, std::vector<cv::Mat>& netOutput, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis)
+{
     // Scan through all bounding boxes and keep only the ones with high confidence
     vector<int> classIds; vector<float> confidences; vector<cv::Rect> boxes;
     for (size_t i = 0; i < netOutput.size(); ++i)
@@ -127,3 +200,11 @@ void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThr
         cv::waitKey(0); // wait for key to be pressed
     }
 }
+
+// one-shot convenience wrapper, loads the network for every call; prefer keeping an ObjectDetector alive when processing a sequence
+void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
+                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+{
+    ObjectDetector detector(classesFile, modelConfiguration, modelWeights);
+    detector.detect(img, bBoxes, confThreshold, nmsThreshold, bVis);
+}
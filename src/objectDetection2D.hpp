@@ -3,10 +3,36 @@
 #define objectDetection2D_hpp
 
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
 #include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
 
 #include "dataStructures.h"
 
+// YOLO object detector which loads the class list and network once and reuses them for every frame;
+// detection calls are serialized internally, so one instance can be shared by concurrent pipeline runs
+class ObjectDetector
+{
+public:
+    ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights);
+
+    // process-wide instance for the given model files, loaded on first use
+    static ObjectDetector &shared(std::string classesFile, std::string modelConfiguration, std::string modelWeights);
+
+    void detect(const cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis);
+    void detectBatch(const std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes, float confThreshold, float nmsThreshold, bool bVis);
+
+private:
+    void postprocess(const cv::Mat& img, std::vector<cv::Mat>& netOutput, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis);
+
+    std::vector<std::string> classes; // class names listed in "coco.names"
+    cv::dnn::Net net;
+    std::vector<cv::String> outputNames; // names of the unconnected output layers
+    std::mutex netMutex; // cv::dnn::Net must not run forward passes concurrently
+};
+
 void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
                    std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis);
 
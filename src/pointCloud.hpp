@@ -0,0 +1,84 @@
+
+#ifndef pointCloud_hpp
+#define pointCloud_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// allocator for std::vector which returns memory aligned for SIMD loads
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(cv::fastMalloc(n * sizeof(T))); }
+    void deallocate(T *p, size_t) { cv::fastFree(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloats;
+
+// Lidar points stored as structure of arrays: point i is (x[i], y[i], z[i]) in [m] with reflectivity r[i]
+struct PointCloud
+{
+    AlignedFloats x, y, z, r;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void clear() { x.clear(); y.clear(); z.clear(); r.clear(); }
+    void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); r.reserve(n); }
+    void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); r.resize(n); }
+
+    void push_back(float px, float py, float pz, float pr)
+    {
+        x.push_back(px); y.push_back(py); z.push_back(pz); r.push_back(pr);
+    }
+
+    // appends point i of src
+    void push_back(const PointCloud &src, size_t i) { push_back(src.x[i], src.y[i], src.z[i], src.r[i]); }
+
+    // replaces the contents by the points of src at the given indices
+    void assign(const PointCloud &src, const std::vector<int> &indices)
+    {
+        resize(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            x[i] = src.x[indices[i]]; y[i] = src.y[indices[i]]; z[i] = src.z[indices[i]]; r[i] = src.r[indices[i]];
+        }
+    }
+};
+
+// Read-only access to a whole point cloud or to the subset given by a list of indices, without copying points.
+// The cloud and the indices must outlive the view.
+class PointCloudView
+{
+public:
+    PointCloudView(const PointCloud &cloud) : cloud(&cloud), indices(nullptr) {}
+    PointCloudView(const PointCloud &cloud, const std::vector<int> &indices) : cloud(&cloud), indices(&indices) {}
+
+    size_t size() const { return indices ? indices->size() : cloud->size(); }
+    bool empty() const { return size() == 0; }
+
+    // index of the i-th point of the view within the underlying cloud
+    size_t index(size_t i) const { return indices ? (*indices)[i] : i; }
+
+    float x(size_t i) const { return cloud->x[index(i)]; }
+    float y(size_t i) const { return cloud->y[index(i)]; }
+    float z(size_t i) const { return cloud->z[index(i)]; }
+    float r(size_t i) const { return cloud->r[index(i)]; }
+
+private:
+    const PointCloud *cloud;
+    const std::vector<int> *indices; // nullptr for the whole cloud
+};
+
+#endif /* pointCloud_hpp */
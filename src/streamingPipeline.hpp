@@ -0,0 +1,166 @@
+
+#ifndef streamingPipeline_hpp
+#define streamingPipeline_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <memory>
+
+// Bounded single-producer/single-consumer ring buffer without locks. Producer and consumer wait by yielding
+// and, once the queue stays full or empty for a while, by sleeping briefly.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(size_t capacity, const std::atomic<bool> &aborted) : slots(capacity + 1), head(0), tail(0), closed(false), aborted(aborted) {}
+
+    // blocks while the queue is full, returns false if the pipeline has been aborted
+    bool push(T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % slots.size();
+        for (int spins = 0; next == head.load(std::memory_order_acquire); ++spins)
+        {
+            if (aborted.load(std::memory_order_relaxed)) return false;
+            wait(spins);
+        }
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // blocks while the queue is empty, returns false once it is closed and drained or the pipeline has been aborted
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        for (int spins = 0; h == tail.load(std::memory_order_acquire); ++spins)
+        {
+            if (aborted.load(std::memory_order_relaxed)) return false;
+            if (closed.load(std::memory_order_acquire) && h == tail.load(std::memory_order_acquire)) return false;
+            wait(spins);
+        }
+        item = std::move(slots[h]);
+        head.store((h + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    // called by the producer after its last push
+    void close() { closed.store(true, std::memory_order_release); }
+
+private:
+    static void wait(int spins)
+    {
+        if (spins < 64) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::vector<T> slots; // one slot always stays empty to tell a full from an empty queue
+    std::atomic<size_t> head; // next slot to pop
+    std::atomic<size_t> tail; // next slot to push
+    std::atomic<bool> closed;
+    const std::atomic<bool> &aborted;
+};
+
+// Runs a sequence of stages over a stream of items. Each item passes through all stages in order; in streaming
+// mode every stage has its own thread and consecutive stages are connected by bounded queues, so the throughput
+// approaches that of the slowest stage. The last stage runs on the calling thread (e.g. for visualization).
+template <typename T>
+class StreamingPipeline
+{
+public:
+    explicit StreamingPipeline(size_t queueCapacity = 2) : queueCapacity(queueCapacity) {}
+
+    void addStage(std::function<void(T &)> stage) { stages.push_back(stage); }
+
+    // source fills the next item and returns false once the stream has ended; exceptions thrown by a stage abort the pipeline and are rethrown here
+    void run(std::function<bool(T &)> source)
+    {
+        if (stages.empty()) return;
+
+        std::atomic<bool> aborted(false);
+        std::exception_ptr firstError;
+        std::atomic_flag errorTaken = ATOMIC_FLAG_INIT;
+        auto fail = [&]()
+        {
+            if (!errorTaken.test_and_set()) firstError = std::current_exception();
+            aborted.store(true);
+        };
+
+        // queues[i] feeds stages[i], queues[0] is filled by the source
+        std::vector<std::unique_ptr<SpscQueue<T>>> queues;
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            queues.emplace_back(new SpscQueue<T>(queueCapacity, aborted));
+        }
+
+        std::vector<std::thread> threads;
+        threads.emplace_back([&]()
+        {
+            try
+            {
+                T item;
+                while (source(item) && queues[0]->push(item)) item = T();
+            }
+            catch (...)
+            {
+                fail();
+            }
+            queues[0]->close();
+        });
+        for (size_t i = 0; i + 1 < stages.size(); ++i)
+        {
+            threads.emplace_back([&, i]()
+            {
+                try
+                {
+                    T item;
+                    while (queues[i]->pop(item))
+                    {
+                        stages[i](item);
+                        if (!queues[i + 1]->push(item)) break;
+                    }
+                }
+                catch (...)
+                {
+                    fail();
+                }
+                queues[i + 1]->close();
+            });
+        }
+
+        try
+        {
+            T item;
+            while (queues.back()->pop(item)) stages.back()(item);
+        }
+        catch (...)
+        {
+            fail();
+        }
+
+        for (auto &t : threads) t.join();
+        if (firstError) std::rethrow_exception(firstError);
+    }
+
+    // processes one item after the other through all stages on the calling thread
+    void runSequential(std::function<bool(T &)> source)
+    {
+        T item;
+        while (source(item))
+        {
+            for (auto &stage : stages) stage(item);
+            item = T();
+        }
+    }
+
+private:
+    std::vector<std::function<void(T &)>> stages;
+    size_t queueCapacity; // max. no. of items waiting in front of each stage
+};
+
+#endif /* streamingPipeline_hpp */
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <opencv2/core.hpp>
+
+#include "sweepEngine.hpp"
+
+using namespace std;
+
+// job queue owned by one worker; the owner takes jobs from the front, idle workers steal from the back
+struct WorkQueue
+{
+    mutex queueMutex;
+    deque<size_t> jobIndices;
+};
+
+static bool popOwnJob(WorkQueue &queue, size_t &jobIndex)
+{
+    lock_guard<mutex> lock(queue.queueMutex);
+    if (queue.jobIndices.empty()) return false;
+    jobIndex = queue.jobIndices.front();
+    queue.jobIndices.pop_front();
+    return true;
+}
+
+static bool stealJob(WorkQueue &queue, size_t &jobIndex)
+{
+    lock_guard<mutex> lock(queue.queueMutex);
+    if (queue.jobIndices.empty()) return false;
+    jobIndex = queue.jobIndices.back();
+    queue.jobIndices.pop_back();
+    return true;
+}
+
+void runSweep(std::vector<SweepJob> &jobs, std::function<void(SweepJob &)> runJob, unsigned numThreads)
+{
+    if (jobs.empty()) return;
+    auto runCaught = [&](size_t jobIndex)
+    {
+        try
+        {
+            runJob(jobs[jobIndex]);
+        }
+        catch (const exception &e)
+        {
+            jobs[jobIndex].error = e.what();
+        }
+    };
+
+    // the shared data is computed once, by the first job and with all cores
+    jobs[0].bConcurrent = false;
+    runCaught(0);
+
+    if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+    numThreads = (unsigned)min<size_t>(numThreads, jobs.size() - 1);
+    if (numThreads == 0) return;
+
+    // every other job is single threaded, the parallelism comes from running the jobs side by side
+    bool bConcurrent = numThreads > 1;
+    for (size_t i = 1; i < jobs.size(); ++i) jobs[i].bConcurrent = bConcurrent;
+    int cvNumThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+
+    // no job ever enters a queue after this point, so a worker can stop once all queues are empty
+    vector<WorkQueue> queues(numThreads);
+    for (size_t i = 1; i < jobs.size(); ++i)
+    {
+        queues[i % numThreads].jobIndices.push_back(i);
+    }
+
+    auto worker = [&](unsigned self)
+    {
+        size_t jobIndex;
+        while (true)
+        {
+            bool bFound = popOwnJob(queues[self], jobIndex);
+            for (unsigned victim = 1; !bFound && victim < numThreads; ++victim)
+            {
+                bFound = stealJob(queues[(self + victim) % numThreads], jobIndex);
+            }
+            if (!bFound) break;
+
+            runCaught(jobIndex);
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 1; i < numThreads; ++i)
+    {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &t : workers) t.join();
+
+    cv::setNumThreads(cvNumThreads);
+}
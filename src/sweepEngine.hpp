@@ -0,0 +1,25 @@
+
+#ifndef sweepEngine_hpp
+#define sweepEngine_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+struct SweepJob { // one detector/descriptor combination of a parameter sweep, with its own result buffer
+    
+    std::string detectorType;
+    std::string descriptorType;
+
+    std::vector<float> TTCEstimates; // camera TTC for each processed frame
+    std::string error; // non-empty if the job has thrown an exception
+    bool bConcurrent = false; // set by runSweep if other jobs run side by side, the job must then not start threads of its own
+};
+
+// runs the first job alone, with OpenCV's own threading, so that it computes the per-frame data all jobs share
+// (decoded images, YOLO detections, see FrameStore); the other jobs then run concurrently on a work-stealing thread
+// pool (numThreads=0 uses all cores), with OpenCV's internal threading switched off to avoid oversubscription
+void runSweep(std::vector<SweepJob> &jobs, std::function<void(SweepJob &)> runJob, unsigned numThreads = 0);
+
+#endif /* sweepEngine_hpp */
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+
+#include "tracing.hpp"
+
+using namespace std;
+
+Tracer &Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+int64_t Tracer::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Tracer::ThreadBuffer &Tracer::threadBuffer()
+{
+    thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer)
+    {
+        lock_guard<mutex> lock(buffersMutex);
+        buffers.emplace_back(new ThreadBuffer());
+        buffer = buffers.back().get();
+        buffer->tid = (int)buffers.size();
+    }
+    return *buffer;
+}
+
+void Tracer::recordDuration(const char *name, int64_t start, int64_t end)
+{
+    ThreadBuffer &buffer = threadBuffer();
+    Event event = { name, false, start, end - start, 0.0 };
+    lock_guard<mutex> lock(buffer.mutex);
+    buffer.events.push_back(event);
+}
+
+void Tracer::recordCounter(const char *name, double value)
+{
+    ThreadBuffer &buffer = threadBuffer();
+    Event event = { name, true, now(), 0, value };
+    lock_guard<mutex> lock(buffer.mutex);
+    buffer.events.push_back(event);
+}
+
+void Tracer::clear()
+{
+    lock_guard<mutex> lock(buffersMutex);
+    for (auto &buffer : buffers)
+    {
+        lock_guard<mutex> bufferLock(buffer->mutex);
+        buffer->events.clear();
+    }
+}
+
+bool Tracer::writeChromeTrace(const std::string &filename) const
+{
+    ofstream file(filename);
+    if (!file) return false;
+
+    // timestamps relative to the first event, in [us] as expected by the format
+    lock_guard<mutex> lock(buffersMutex);
+    int64_t t0 = numeric_limits<int64_t>::max();
+    for (auto &buffer : buffers)
+    {
+        lock_guard<mutex> bufferLock(buffer->mutex);
+        for (auto &event : buffer->events) t0 = min(t0, event.ts);
+    }
+
+    file << "{\"traceEvents\":[" << fixed << setprecision(3);
+    bool bFirst = true;
+    for (auto &buffer : buffers)
+    {
+        lock_guard<mutex> bufferLock(buffer->mutex);
+        for (auto &event : buffer->events)
+        {
+            file << (bFirst ? "\n" : ",\n");
+            bFirst = false;
+            file << "{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << (event.ts - t0) / 1000.0;
+            if (event.bCounter) file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+            else file << ",\"ph\":\"X\",\"dur\":" << event.dur / 1000.0 << "}";
+        }
+    }
+    file << "\n]}\n";
+    return (bool)file;
+}
+
+void Tracer::printSummary(std::ostream &os) const
+{
+    map<string, vector<double>> durations, counters; // [ms] resp. values, by name
+    {
+        lock_guard<mutex> lock(buffersMutex);
+        for (auto &buffer : buffers)
+        {
+            lock_guard<mutex> bufferLock(buffer->mutex);
+            for (auto &event : buffer->events)
+            {
+                if (event.bCounter) counters[event.name].push_back(event.value);
+                else durations[event.name].push_back(event.dur / 1e6);
+            }
+        }
+    }
+
+    // nearest-rank percentile of sorted values
+    auto percentile = [](const vector<double> &sorted, double p)
+    {
+        size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+        return sorted[rank > 0 ? rank - 1 : 0];
+    };
+
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+    os << fixed << setprecision(3);
+    os << "section | count | mean [ms] | p50 | p95 | p99 | max" << endl;
+    for (auto &entry : durations)
+    {
+        vector<double> &values = entry.second;
+        sort(values.begin(), values.end());
+        double sum = 0;
+        for (double v : values) sum += v;
+        os << entry.first << " | " << values.size() << " | " << sum / values.size() << " | " << percentile(values, 50) << " | "
+           << percentile(values, 95) << " | " << percentile(values, 99) << " | " << values.back() << endl;
+    }
+    if (!counters.empty()) os << "counter | count | mean | min | max" << endl;
+    for (auto &entry : counters)
+    {
+        vector<double> &values = entry.second;
+        double sum = 0;
+        for (double v : values) sum += v;
+        os << entry.first << " | " << values.size() << " | " << sum / values.size() << " | "
+           << *min_element(values.begin(), values.end()) << " | " << *max_element(values.begin(), values.end()) << endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
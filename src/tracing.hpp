@@ -0,0 +1,88 @@
+
+#ifndef tracing_hpp
+#define tracing_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+
+// Process-wide recorder of timed sections and counters. Each thread appends to its own buffer, so recording from
+// several pipeline stages does not contend. While disabled, ScopedTimer and traceCounter() only read one flag.
+// Event names must be string literals (or otherwise outlive the tracer).
+class Tracer
+{
+public:
+    static Tracer &instance();
+
+    bool enabled() const { return bEnabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool bEnable) { bEnabled.store(bEnable, std::memory_order_relaxed); }
+
+    // monotonic time in [ns]
+    static int64_t now();
+
+    void recordDuration(const char *name, int64_t start, int64_t end);
+    void recordCounter(const char *name, double value);
+
+    // Chrome trace event format, viewable in chrome://tracing or Perfetto; returns false if the file cannot be written
+    bool writeChromeTrace(const std::string &filename) const;
+    // per name: count and mean / p50 / p95 / p99 / max duration, or mean / min / max value for counters
+    void printSummary(std::ostream &os) const;
+    void clear();
+
+private:
+    Tracer() : bEnabled(false) {}
+
+    struct Event
+    {
+        const char *name;
+        bool bCounter;
+        int64_t ts, dur; // [ns]
+        double value;
+    };
+    struct ThreadBuffer
+    {
+        int tid;
+        std::mutex mutex; // only contended while the events are written or cleared
+        std::vector<Event> events;
+    };
+    ThreadBuffer &threadBuffer();
+
+    std::atomic<bool> bEnabled;
+    mutable std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers; // one per thread which has recorded events, never removed
+};
+
+// records the lifetime of the object, or the time until stop(), as a section named name
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *name) : eventName(Tracer::instance().enabled() ? name : nullptr), start(eventName ? Tracer::now() : 0) {}
+    ~ScopedTimer() { stop(); }
+
+    void stop()
+    {
+        if (eventName) Tracer::instance().recordDuration(eventName, start, Tracer::now());
+        eventName = nullptr;
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer &operator=(const ScopedTimer &);
+
+    const char *eventName; // nullptr while tracing is disabled
+    int64_t start;
+};
+
+// records a value such as the no. of keypoints of the current frame
+inline void traceCounter(const char *name, double value)
+{
+    Tracer &tracer = Tracer::instance();
+    if (tracer.enabled()) tracer.recordCounter(name, value);
+}
+
+#endif /* tracing_hpp */
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "visualizationSink.hpp"
+#include "lidarData.hpp"
+#include "tracing.hpp"
+
+using namespace std;
+
+void VisFrame::line(cv::Point2f pt1, cv::Point2f pt2, const cv::Scalar &color, int thickness)
+{
+    Command command = { CommandType::LINE, pt1, pt2, color, thickness, 0.0, 0 };
+    commands.push_back(command);
+}
+
+void VisFrame::rectangle(const cv::Rect &rect, const cv::Scalar &color, int thickness)
+{
+    Command command = { CommandType::RECTANGLE, rect.tl(), rect.br(), color, thickness, 0.0, 0 };
+    commands.push_back(command);
+}
+
+void VisFrame::text(const std::string &str, cv::Point2f org, double fontScale, const cv::Scalar &color)
+{
+    Command command = { CommandType::TEXT, org, org, color, 1, fontScale, texts.size() };
+    commands.push_back(command);
+    texts.push_back(str);
+}
+
+void VisFrame::lidarOverlay(const PointCloud &lidarPoints, const std::vector<cv::Point> &lidarImgPoints)
+{
+    Command command = { CommandType::LIDAR, cv::Point2f(), cv::Point2f(), cv::Scalar(), 0, 0.0, overlays.size() };
+    commands.push_back(command);
+    overlays.push_back(make_pair(lidarPoints, lidarImgPoints));
+}
+
+cv::Mat VisFrame::render()
+{
+    cv::Mat visImg = background.clone();
+    for (auto &command : commands)
+    {
+        switch (command.type)
+        {
+        case CommandType::LINE:
+            cv::line(visImg, command.pt1, command.pt2, command.color, command.thickness);
+            break;
+        case CommandType::RECTANGLE:
+            cv::rectangle(visImg, command.pt1, command.pt2, command.color, command.thickness);
+            break;
+        case CommandType::TEXT:
+            cv::putText(visImg, texts[command.arg], command.pt1, cv::FONT_HERSHEY_PLAIN, command.fontScale, command.color, command.thickness);
+            break;
+        case CommandType::LIDAR:
+            showLidarImgOverlay(visImg, overlays[command.arg].first, overlays[command.arg].second, &visImg);
+            break;
+        }
+    }
+    return visImg;
+}
+
+std::string VisFrame::filename() const
+{
+    char number[16];
+    snprintf(number, sizeof(number), "_%02d.png", index);
+    return stream + number;
+}
+
+VisualizationSink::VisualizationSink(double videoFps, size_t maxPending)
+    : videoFps(videoFps), aborted(false), queue(maxPending, aborted)
+{
+    writer = thread([this]()
+    {
+        VisFrame frame;
+        while (queue.pop(frame))
+        {
+            write(frame);
+            frame = VisFrame(); // releases the background image
+        }
+    });
+}
+
+VisualizationSink::~VisualizationSink()
+{
+    queue.close();
+    writer.join();
+    for (auto &video : videos) video.second.release();
+}
+
+void VisualizationSink::submit(VisFrame &frame)
+{
+    queue.push(frame);
+}
+
+void VisualizationSink::write(VisFrame &frame)
+{
+    ScopedTimer timer("writeResultImage");
+    try
+    {
+        cv::Mat visImg = frame.render();
+        if (videoFps <= 0)
+        {
+            if (!cv::imwrite(frame.filename(), visImg)) cerr << "cannot write " << frame.filename() << endl;
+            return;
+        }
+
+        // the first frame of a stream determines the frame size of its video
+        cv::VideoWriter &video = videos[frame.stream];
+        if (!video.isOpened() && !video.open(frame.stream + ".avi", cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), videoFps, visImg.size()))
+        {
+            cerr << "cannot write " << frame.stream << ".avi" << endl;
+            return;
+        }
+        video.write(visImg);
+    }
+    catch (const cv::Exception &e)
+    {
+        cerr << "cannot write result image " << frame.filename() << ": " << e.what() << endl;
+    }
+}
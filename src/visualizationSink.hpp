@@ -0,0 +1,91 @@
+
+#ifndef visualizationSink_hpp
+#define visualizationSink_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "dataStructures.h"
+#include "streamingPipeline.hpp"
+
+// how run() presents the results of each tracked object
+enum class VisMode
+{
+    HEADLESS,    // nothing is rendered
+    INTERACTIVE, // rendered and written on the tracking thread, then shown in a window which waits for a key
+    ASYNC        // draw commands are handed to a VisualizationSink, which renders and writes them on its own thread
+};
+
+// A result image described by draw commands on top of a background image. Recording a command only copies its
+// coordinates; the background is shared and left unmodified, render() draws onto a copy of it.
+class VisFrame
+{
+public:
+    VisFrame() : index(0) {}
+    VisFrame(const std::string &stream, int index, const cv::Mat &background) : stream(stream), index(index), background(background) {}
+
+    void line(cv::Point2f pt1, cv::Point2f pt2, const cv::Scalar &color, int thickness = 1);
+    void rectangle(const cv::Rect &rect, const cv::Scalar &color, int thickness = 1);
+    void text(const std::string &str, cv::Point2f org, double fontScale, const cv::Scalar &color);
+    // Lidar points colored by distance, as by showLidarImgOverlay()
+    void lidarOverlay(const PointCloud &lidarPoints, const std::vector<cv::Point> &lidarImgPoints);
+
+    // draws all commands in the order they were recorded
+    cv::Mat render();
+
+    // <stream>_<index>.png
+    std::string filename() const;
+
+    std::string stream; // name of the image sequence this frame belongs to, e.g. "augmented"
+    int index; // frame no. within the stream
+
+private:
+    enum class CommandType { LINE, RECTANGLE, TEXT, LIDAR };
+    struct Command
+    {
+        CommandType type;
+        cv::Point2f pt1, pt2;
+        cv::Scalar color;
+        int thickness;
+        double fontScale;
+        size_t arg; // index into texts resp. overlays
+    };
+
+    cv::Mat background;
+    std::vector<Command> commands;
+    std::vector<std::string> texts;
+    std::vector<std::pair<PointCloud, std::vector<cv::Point>>> overlays;
+};
+
+// Renders and writes result images on a background thread, so that the latency of the submitting thread does not
+// include drawing or image encoding. Each stream is written as PNG files <stream>_<index>.png or, with a video frame
+// rate > 0, as the MJPG video <stream>.avi. Frames must be submitted from a single thread.
+class VisualizationSink
+{
+public:
+    explicit VisualizationSink(double videoFps = 0, size_t maxPending = 32);
+    ~VisualizationSink(); // writes all pending frames
+
+    // returns immediately unless maxPending frames are still waiting to be written
+    void submit(VisFrame &frame);
+
+private:
+    VisualizationSink(const VisualizationSink &);
+    VisualizationSink &operator=(const VisualizationSink &);
+
+    void write(VisFrame &frame);
+
+    double videoFps;
+    std::map<std::string, cv::VideoWriter> videos; // by stream, only used by the writer thread
+    std::atomic<bool> aborted; // never set, the queue is closed instead
+    SpscQueue<VisFrame> queue;
+    std::thread writer;
+};
+
+#endif /* visualizationSink_hpp */